@@ -0,0 +1,563 @@
+#include "Base64.h"
+#include "BlobStore.h"
+#include "ClipboardHistory.h"
+#include "ContentHash.h"
+#include "FuzzyMatch.h"
+#include "HistoryLog.h"
+#include "HistoryView.h"
+#include "PayloadCodec.h"
+#include "PosixIO.h"
+#include "StringUtils.h"
+#include "TextSearch.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Usage: history-bench [name filter]
+//
+// Each case runs until it has taken at least BENCH_MIN_TIME_MS (default 200)
+// and reports time, throughput over the bytes it processes, and heap
+// allocations per iteration.
+
+namespace
+{
+std::atomic<std::uint64_t> allocation_count{0};
+std::atomic<std::uint64_t> allocation_bytes{0};
+}
+
+// Counting replacements for the global allocation functions. They stay out of
+// line so GCC does not see malloc/free through them and report mismatched
+// new/delete pairs.
+[[gnu::noinline]] void *operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+std::string_view filter;
+std::chrono::nanoseconds min_time = std::chrono::milliseconds(200);
+
+template <typename T>
+void keep(const T &value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+template <typename F>
+void run(std::string_view name, std::uint64_t bytes_per_iteration, F &&body)
+{
+    if (name.find(filter) == std::string_view::npos)
+    {
+        return;
+    }
+
+    body();
+    std::uint64_t iterations = 1;
+    while (true)
+    {
+        const auto count_before = allocation_count.load(std::memory_order_relaxed);
+        const auto bytes_before = allocation_bytes.load(std::memory_order_relaxed);
+        const auto start = Clock::now();
+        for (std::uint64_t i = 0; i < iterations; ++i)
+        {
+            body();
+        }
+        const auto elapsed = Clock::now() - start;
+        if (elapsed < min_time && iterations < (1ull << 40))
+        {
+            iterations *= 2;
+            continue;
+        }
+
+        const double ns = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(iterations);
+        const double mib_per_s = bytes_per_iteration ? bytes_per_iteration / (ns / 1e9) / (1024.0 * 1024.0) : 0.0;
+        const double allocs =
+            static_cast<double>(allocation_count.load(std::memory_order_relaxed) - count_before) / iterations;
+        const double alloc_bytes =
+            static_cast<double>(allocation_bytes.load(std::memory_order_relaxed) - bytes_before) / iterations;
+        std::printf("%-36.*s %12llu %14.0f %12.1f %12.1f %14.0f\n", static_cast<int>(name.size()), name.data(),
+                    static_cast<unsigned long long>(iterations), ns, mib_per_s, allocs, alloc_bytes);
+        return;
+    }
+}
+
+std::uint64_t history_bytes(const clipboard::ClipboardHistory &history)
+{
+    std::uint64_t bytes = 0;
+    for (const auto &entry : history)
+    {
+        for (const auto &[mime, payload] : entry)
+        {
+            bytes += payload.size();
+        }
+    }
+    return bytes;
+}
+
+std::string text_payload(std::size_t size, std::size_t seed)
+{
+    static constexpr std::string_view words = "lorem ipsum dolor sit amet\nconsectetur\tadipiscing elit ";
+    std::string text;
+    text.reserve(size);
+    for (std::size_t i = 0; text.size() < size; ++i)
+    {
+        text += words[(i + seed) % words.size()];
+    }
+    return text;
+}
+
+std::string binary_payload(std::size_t size, std::size_t seed)
+{
+    std::string data(size, '\0');
+    std::uint64_t state = seed * 0x9e3779b97f4a7c15ull + 1;
+    for (auto &byte : data)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        byte = static_cast<char>(state);
+    }
+    return data;
+}
+
+// Words of random letters, so entries do not share most of their trigrams.
+std::string prose_payload(std::size_t size, std::size_t seed)
+{
+    std::string text = binary_payload(size, seed);
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+        const auto byte = static_cast<std::uint8_t>(text[i]);
+        text[i] = byte % 6 == 0 ? ' ' : static_cast<char>('a' + byte % 26);
+    }
+    return text;
+}
+
+clipboard::ClipboardHistory text_history(std::size_t entries, std::size_t size)
+{
+    clipboard::ClipboardHistory history;
+    for (std::size_t i = 0; i < entries; ++i)
+    {
+        history.push_back({{"text/plain", text_payload(size, i)}});
+    }
+    return history;
+}
+
+clipboard::ClipboardHistory image_history(std::size_t entries, std::size_t size)
+{
+    clipboard::ClipboardHistory history;
+    for (std::size_t i = 0; i < entries; ++i)
+    {
+        history.push_back({{"image/png", binary_payload(size, i)}});
+    }
+    return history;
+}
+
+// Browsers and office suites offer the same selection under many types.
+clipboard::ClipboardHistory many_mime_history(std::size_t entries, std::size_t size)
+{
+    static constexpr const char *mimes[] = {
+        "text/plain", "text/plain;charset=utf-8", "UTF8_STRING", "TEXT", "STRING",
+        "text/html", "application/x-moz-nativehtml", "chromium/x-web-custom-data",
+    };
+    clipboard::ClipboardHistory history;
+    for (std::size_t i = 0; i < entries; ++i)
+    {
+        clipboard::ClipboardEntry entry;
+        const auto text = text_payload(size, i);
+        for (std::size_t m = 0; m < std::size(mimes); ++m)
+        {
+            entry.insert_or_assign(mimes[m], m < 5 ? text : "<p>" + text + std::to_string(m) + "</p>");
+        }
+        history.push_back(std::move(entry));
+    }
+    return history;
+}
+
+std::vector<clipboard::EntryDigest> digest_history(const clipboard::ClipboardHistory &history)
+{
+    std::vector<clipboard::EntryDigest> digests;
+    for (const auto &entry : history)
+    {
+        digests.push_back(clipboard::digest_entry(entry));
+    }
+    return digests;
+}
+
+void write_legacy_json(const clipboard::ClipboardHistory &history)
+{
+    std::ofstream file(clipboard::legacy_history_path());
+    file << '[';
+    for (std::size_t i = 0; i < history.size(); ++i)
+    {
+        file << (i ? ",{" : "{");
+        bool first = true;
+        for (const auto &[mime, payload] : history[i])
+        {
+            file << (first ? "" : ",") << '"' << clipboard::mime_name(mime) << "\":\"" << clipboard::base64_encode(payload.data()) << '"';
+            first = false;
+        }
+        file << '}';
+    }
+    file << ']';
+}
+
+void bench_storage(const std::string &label, const clipboard::ClipboardHistory &history)
+{
+    const auto path = clipboard::history_path();
+    const auto bytes = history_bytes(history);
+    const auto digests = digest_history(history);
+    const clipboard::HistoryLimits limits{.max_entries = history.size(), .max_bytes = bytes + 1};
+    // Readers need a log even when the filter skips log_write.
+    clipboard::write_history_log(path, history, digests);
+
+    run("digest/" + label, bytes, [&]
+        { keep(digest_history(history)); });
+    run("log_write/" + label, bytes, [&]
+        { keep(clipboard::write_history_log(path, history, digests)); });
+    run("log_replay/" + label, bytes, [&]
+        { keep(clipboard::replay_history_log(path)); });
+    run("view_open/" + label, bytes, [&]
+        {
+            clipboard::HistoryView view;
+            keep(view.open(path)); });
+    run("log_append/" + label, bytes, [&]
+        {
+            std::filesystem::remove(path);
+            clipboard::HistoryLog log(path, limits);
+            auto stored = log.open();
+            for (std::size_t i = history.size(); i-- > 0;)
+            {
+                log.push_front(stored, history[i], digests[i]);
+            }
+            keep(stored); });
+    // The same pushes through the background writer, which batches their
+    // appends into one write and one fdatasync.
+    run("log_append_batched/" + label, bytes, [&]
+        {
+            std::filesystem::remove(path);
+            clipboard::HistoryLog log(path, limits);
+            auto stored = log.open();
+            log.write_in_background(std::chrono::seconds(1));
+            for (std::size_t i = history.size(); i-- > 0;)
+            {
+                log.push_front(stored, history[i], digests[i]);
+            }
+            keep(log.flush()); });
+
+    std::filesystem::remove(path);
+    write_legacy_json(history);
+    run("legacy_json_load/" + label, bytes, [&]
+        { keep(clipboard::load_history()); });
+    std::filesystem::remove(clipboard::legacy_history_path());
+}
+
+void bench_base64()
+{
+    constexpr std::size_t size = 1024 * 1024;
+    const auto data = binary_payload(size, 2);
+    const auto encoded = clipboard::base64_encode(data);
+    for (const auto &[name, level] : {std::pair{"scalar", clipboard::SimdLevel::scalar},
+                                      std::pair{"sse41", clipboard::SimdLevel::sse41},
+                                      std::pair{"avx2", clipboard::SimdLevel::avx2}})
+    {
+        if (level > clipboard::best_simd_level())
+        {
+            break;
+        }
+        run(std::string("base64_encode/1MiB/") + name, size, [&]
+            { keep(clipboard::base64_encode(data, level)); });
+        run(std::string("base64_decode/1MiB/") + name, size, [&]
+            { keep(clipboard::base64_decode(encoded, level)); });
+    }
+}
+
+void bench_codecs()
+{
+    constexpr std::size_t size = 64 * 1024;
+    const auto text = text_payload(size, 3);
+    for (const auto &[name, codec] : {std::pair{"lz4", clipboard::Codec::lz4},
+                                      std::pair{"zstd", clipboard::Codec::zstd}})
+    {
+        const auto compressed = clipboard::compress_payload(codec, text);
+        if (!compressed)
+        {
+            std::abort();
+        }
+        run(std::string("payload_compress/64KiB_text/") + name, size, [&]
+            { keep(clipboard::compress_payload(codec, text)); });
+        // A restore decodes a payload on its first read.
+        run(std::string("payload_decompress/64KiB_text/") + name, size, [&]
+            { keep(clipboard::Payload::compressed(*compressed, codec, size, 0).data().size()); });
+    }
+}
+
+void bench_search()
+{
+    constexpr std::size_t entries = 2000;
+    constexpr std::size_t size = 4096;
+    clipboard::ClipboardHistory history;
+    for (std::size_t i = 0; i < entries; ++i)
+    {
+        history.push_back({{"text/plain", prose_payload(size, i)}});
+    }
+    // Stored as the watcher would store them.
+    const auto digests = digest_history(history);
+    for (std::size_t i = 0; i < entries; ++i)
+    {
+        clipboard::compress_entry(history[i], digests[i]);
+    }
+    const auto path = clipboard::history_path();
+    clipboard::write_history_log(path, history, digests);
+
+    const auto hit = history[1234].at("text/plain").load().substr(1000, 12);
+    const auto bytes = entries * size;
+    for (const auto &[name, query] : {std::pair{"hit", hit}, std::pair{"miss", std::string("zqxjzqxjzqxj")}})
+    {
+        run(std::string("history_search/2000x4KiB_text/") + name, bytes, [&]
+            {
+                clipboard::HistoryView view;
+                view.open(path);
+                keep(view.search(query)); });
+    }
+    // Capturing a large text builds its filter on the watcher's event loop.
+    const auto large = prose_payload(16 * 1024 * 1024, 0);
+    run("trigram_filter/16MiB_text", large.size(), [&]
+        { keep(clipboard::trigram_filter(large)); });
+    // Reading every text, as a search without the filters would.
+    run("history_scan/2000x4KiB_text", bytes, [&]
+        {
+            clipboard::HistoryView view;
+            view.open(path);
+            const clipboard::TextQuery text_query(hit);
+            std::size_t found = 0;
+            for (const auto &entry : view)
+            {
+                found += text_query.matches(*entry.find("text/plain"));
+            }
+            keep(found); });
+}
+
+void bench_fuzzy_match()
+{
+    // Picker previews are at most 200 characters.
+    std::vector<std::string> previews;
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < 2000; ++i)
+    {
+        previews.push_back(prose_payload(200, i));
+        bytes += previews.back().size();
+    }
+    for (const auto &[name, level] : {std::pair{"scalar", clipboard::SimdLevel::scalar},
+                                      std::pair{"sse41", clipboard::SimdLevel::sse41},
+                                      std::pair{"avx2", clipboard::SimdLevel::avx2}})
+    {
+        if (level > clipboard::best_simd_level())
+        {
+            break;
+        }
+        // Short queries match most previews and are dominated by scoring;
+        // long ones are mostly rejected by the vector prefilter.
+        for (const auto &[label, query] : {std::pair{"short", "abc"}, std::pair{"long", "quick brown fox"}})
+        {
+            const clipboard::FuzzyQuery fuzzy_query(query, level);
+            run(std::string("fuzzy_match/2000x200B/") + label + "/" + name, bytes, [&]
+                {
+                    std::size_t matched = 0;
+                    for (const auto &preview : previews)
+                    {
+                        matched += fuzzy_query.score(preview).has_value();
+                    }
+                    keep(matched); });
+        }
+    }
+}
+
+void bench_preview()
+{
+    for (const std::size_t size : {64, 4096, 1024 * 1024})
+    {
+        const auto text = text_payload(size, 0);
+        // The preview stops after its first 200 characters, so no throughput.
+        run("single_line_preview/" + std::to_string(size) + "B", 0, [&]
+            { keep(clipboard::single_line_preview(text)); });
+    }
+
+    const auto path = clipboard::history_path();
+    for (const auto &[label, history] : {std::pair{"25x200B_text", text_history(25, 200)},
+                                         std::pair{"1000x200B_text", text_history(1000, 200)},
+                                         std::pair{"25x8_mime", many_mime_history(25, 1024)}})
+    {
+        clipboard::write_history_log(path, history, digest_history(history));
+        clipboard::HistoryView view;
+        if (!view.open(path))
+        {
+            std::abort();
+        }
+        run(std::string("picker_labels/") + label, 0, [&]
+            {
+                std::vector<std::string> labels;
+                for (std::size_t i = 0; i < view.size(); ++i)
+                {
+                    labels.push_back(clipboard::picker_label(i, view[i]));
+                }
+                keep(labels); });
+    }
+    std::filesystem::remove(path);
+}
+
+// The watcher's capture path: drain a pipe into memory, or splice it into a
+// blob file once the payload is large.
+void bench_capture()
+{
+    const auto blob_dir = clipboard::blob_directory(clipboard::history_path());
+    for (const std::size_t size : {4096, 1024 * 1024, 16 * 1024 * 1024})
+    {
+        const auto payload = binary_payload(size, 1);
+        const auto label = std::to_string(size) + "B";
+
+        const auto capture = [&](auto &&consume)
+        {
+            int fds[2];
+            if (pipe(fds) != 0)
+            {
+                std::abort();
+            }
+            clipboard::UniqueFd read_end(fds[0]);
+            std::thread writer([&, fd = fds[1]]
+                               {
+                                   clipboard::write_all(fd, payload);
+                                   close(fd); });
+            consume(read_end.get());
+            writer.join();
+        };
+
+        run("capture_memory/" + label, size, [&]
+            {
+                capture([&](int fd)
+                        {
+                            std::string content;
+                            char buffer[4096];
+                            ssize_t n = 0;
+                            while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+                            {
+                                content.append(buffer, static_cast<std::size_t>(n));
+                            }
+                            keep(clipboard::content_hash(content)); }); });
+
+        run("capture_blob/" + label, size, [&]
+            {
+                capture([&](int fd)
+                        {
+                            clipboard::BlobWriter blob;
+                            if (!blob.open(blob_dir))
+                            {
+                                std::abort();
+                            }
+                            // splice_from does not block, like the watcher's
+                            // epoll-driven reads.
+                            while (true)
+                            {
+                                const ssize_t n = blob.splice_from(fd, size);
+                                if (n == 0)
+                                {
+                                    break;
+                                }
+                                if (n < 0)
+                                {
+                                    if (errno != EAGAIN)
+                                    {
+                                        std::abort();
+                                    }
+                                    pollfd readable{.fd = fd, .events = POLLIN, .revents = 0};
+                                    poll(&readable, 1, -1);
+                                }
+                            }
+                            keep(blob.commit()); }); });
+    }
+    std::filesystem::remove_all(blob_dir);
+}
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        filter = argv[1];
+    }
+    if (const char *ms = std::getenv("BENCH_MIN_TIME_MS"))
+    {
+        min_time = std::chrono::milliseconds(std::atoll(ms));
+    }
+
+    std::string tmpl = (std::filesystem::temp_directory_path() / "wl-paste-cpp-bench.XXXXXX").string();
+    const char *dir = mkdtemp(tmpl.data());
+    if (!dir)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("XDG_DATA_HOME", dir, 1);
+
+    std::printf("%-36s %12s %14s %12s %12s %14s\n", "benchmark", "iterations", "ns/op", "MiB/s", "allocs/op",
+                "alloc B/op");
+    bench_storage("25x200B_text", text_history(25, 200));
+    bench_storage("1000x200B_text", text_history(1000, 200));
+    bench_storage("25x64KiB_text", text_history(25, 64 * 1024));
+    bench_storage("10x1MiB_image", image_history(10, 1024 * 1024));
+    bench_storage("25x8_mime", many_mime_history(25, 1024));
+    bench_base64();
+    bench_codecs();
+    bench_search();
+    bench_fuzzy_match();
+    bench_preview();
+    bench_capture();
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -10,7 +10,7 @@
     flake-utils.lib.eachDefaultSystem (system:
       let
         pkgs = nixpkgs.legacyPackages.${system};
-        buildDependencies = with pkgs; [ wayland nlohmann_json ];
+        buildDependencies = with pkgs; [ wayland nlohmann_json lz4 zstd ];
         nativeDependencies = with pkgs; [
           cmake
           meson
@@ -0,0 +1,290 @@
+#include "Base64.h"
+
+#include <array>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLIPBOARD_BASE64_X86 1
+#endif
+
+namespace clipboard
+{
+namespace
+{
+constexpr std::string_view alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+// Vector stores write a full register even when only part of it is output.
+constexpr std::size_t decode_slack = 32;
+
+constexpr auto decode_table = []
+{
+    std::array<std::int8_t, 256> table{};
+    table.fill(-1);
+    for (std::size_t i = 0; i < alphabet.size(); ++i)
+    {
+        table[static_cast<unsigned char>(alphabet[i])] = static_cast<std::int8_t>(i);
+    }
+    return table;
+}();
+
+void encode_scalar(const unsigned char *in, std::size_t size, char *out)
+{
+    std::size_t i = 0;
+    for (; size - i >= 3; i += 3)
+    {
+        const std::uint32_t group = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        *out++ = alphabet[group >> 18];
+        *out++ = alphabet[(group >> 12) & 63];
+        *out++ = alphabet[(group >> 6) & 63];
+        *out++ = alphabet[group & 63];
+    }
+    if (i == size)
+    {
+        return;
+    }
+    const bool two = size - i == 2;
+    const std::uint32_t group = (in[i] << 16) | (two ? in[i + 1] << 8 : 0);
+    *out++ = alphabet[group >> 18];
+    *out++ = alphabet[(group >> 12) & 63];
+    *out++ = two ? alphabet[(group >> 6) & 63] : '=';
+    *out = '=';
+}
+
+// Decodes whole groups of four, the last of which may be padded. Returns the
+// number of bytes written, or std::nullopt when the input is invalid.
+std::optional<std::size_t> decode_scalar(const unsigned char *in, std::size_t size, char *out)
+{
+    const char *const start = out;
+    for (std::size_t i = 0; i < size; i += 4)
+    {
+        const bool last = i + 4 == size;
+        const std::size_t padding = last ? (in[i + 3] == '=') + (in[i + 2] == '=' && in[i + 3] == '=') : 0;
+        std::uint32_t group = 0;
+        for (std::size_t j = 0; j < 4 - padding; ++j)
+        {
+            const auto value = decode_table[in[i + j]];
+            if (value < 0)
+            {
+                return std::nullopt;
+            }
+            group = (group << 6) | static_cast<std::uint32_t>(value);
+        }
+        group <<= 6 * padding;
+
+        *out++ = static_cast<char>(group >> 16);
+        if (padding == 2)
+        {
+            if (group & 0xffff)
+            {
+                return std::nullopt;
+            }
+            break;
+        }
+        *out++ = static_cast<char>(group >> 8);
+        if (padding == 1)
+        {
+            if (group & 0xff)
+            {
+                return std::nullopt;
+            }
+            break;
+        }
+        *out++ = static_cast<char>(group);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+#ifdef CLIPBOARD_BASE64_X86
+// The vector code follows Wojciech Muła's SIMD base64 algorithms: pshufb
+// splits each three input bytes into four 6-bit lanes, and decoding checks
+// and maps characters with nibble-indexed lookup tables.
+
+__attribute__((target("sse4.1"))) __m128i encode_lookup_sse(__m128i indices)
+{
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, reduced), indices);
+}
+
+__attribute__((target("sse4.1"))) __m128i split_sextets_sse(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    const __m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    const __m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(high, low);
+}
+
+// Encodes 12-byte blocks while 16 bytes can be loaded. Returns bytes consumed.
+__attribute__((target("sse4.1"))) std::size_t encode_sse(const unsigned char *in, std::size_t size, char *out)
+{
+    std::size_t done = 0;
+    for (; size - done >= 16; done += 12)
+    {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + done / 3 * 4), encode_lookup_sse(split_sextets_sse(block)));
+    }
+    return done;
+}
+
+__attribute__((target("avx2"))) std::size_t encode_avx2(const unsigned char *in, std::size_t size, char *out)
+{
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                             1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                               'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    std::size_t done = 0;
+    // Each lane takes 12 input bytes; the second load reads 4 bytes past them.
+    for (; size - done >= 28; done += 24)
+    {
+        const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done + 12));
+        __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+        block = _mm256_shuffle_epi8(block, shuffle);
+        const __m256i high =
+            _mm256_mulhi_epu16(_mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        const __m256i low =
+            _mm256_mullo_epi16(_mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(high, low);
+
+        __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, reduced), indices);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + done / 3 * 4), chars);
+    }
+    return done;
+}
+
+// Per high nibble: the offset mapping a character to its value. '/' shares
+// its nibble with '+' and is patched separately.
+#define BASE64_SHIFT_LUT 0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+// Per low nibble: a bit for each high nibble that forms a valid character.
+#define BASE64_MASK_LUT                                                                                            \
+    static_cast<char>(0xa8), static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),            \
+        static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),        \
+        static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54
+#define BASE64_BITPOS_LUT 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80), 0, 0, 0, 0, 0, 0, 0, 0
+#define BASE64_PACK_SHUFFLE 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+// Decodes 16-character blocks until one contains padding or an invalid
+// character, which the scalar code then handles. Returns characters consumed.
+__attribute__((target("sse4.1"))) std::size_t decode_sse(const unsigned char *in, std::size_t size, char *out)
+{
+    const __m128i shift_lut = _mm_setr_epi8(BASE64_SHIFT_LUT);
+    const __m128i mask_lut = _mm_setr_epi8(BASE64_MASK_LUT);
+    const __m128i bitpos_lut = _mm_setr_epi8(BASE64_BITPOS_LUT);
+    const __m128i pack = _mm_setr_epi8(BASE64_PACK_SHUFFLE);
+    std::size_t done = 0;
+    for (; size - done >= 16; done += 16)
+    {
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        const __m128i high = _mm_and_si128(_mm_srli_epi32(input, 4), _mm_set1_epi8(0x0f));
+        const __m128i low = _mm_and_si128(input, _mm_set1_epi8(0x0f));
+        const __m128i valid = _mm_and_si128(_mm_shuffle_epi8(mask_lut, low), _mm_shuffle_epi8(bitpos_lut, high));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(valid, _mm_setzero_si128())) != 0)
+        {
+            break;
+        }
+        const __m128i shift = _mm_blendv_epi8(_mm_shuffle_epi8(shift_lut, high), _mm_set1_epi8(16),
+                                              _mm_cmpeq_epi8(input, _mm_set1_epi8('/')));
+        const __m128i values = _mm_add_epi8(input, shift);
+        const __m128i merged =
+            _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + done / 4 * 3), _mm_shuffle_epi8(merged, pack));
+    }
+    return done;
+}
+
+__attribute__((target("avx2"))) std::size_t decode_avx2(const unsigned char *in, std::size_t size, char *out)
+{
+    const __m256i shift_lut = _mm256_setr_epi8(BASE64_SHIFT_LUT, BASE64_SHIFT_LUT);
+    const __m256i mask_lut = _mm256_setr_epi8(BASE64_MASK_LUT, BASE64_MASK_LUT);
+    const __m256i bitpos_lut = _mm256_setr_epi8(BASE64_BITPOS_LUT, BASE64_BITPOS_LUT);
+    const __m256i pack = _mm256_setr_epi8(BASE64_PACK_SHUFFLE, BASE64_PACK_SHUFFLE);
+    const __m256i join_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    std::size_t done = 0;
+    for (; size - done >= 32; done += 32)
+    {
+        const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + done));
+        const __m256i high = _mm256_and_si256(_mm256_srli_epi32(input, 4), _mm256_set1_epi8(0x0f));
+        const __m256i low = _mm256_and_si256(input, _mm256_set1_epi8(0x0f));
+        const __m256i valid =
+            _mm256_and_si256(_mm256_shuffle_epi8(mask_lut, low), _mm256_shuffle_epi8(bitpos_lut, high));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(valid, _mm256_setzero_si256())) != 0)
+        {
+            break;
+        }
+        const __m256i shift = _mm256_blendv_epi8(_mm256_shuffle_epi8(shift_lut, high), _mm256_set1_epi8(16),
+                                                 _mm256_cmpeq_epi8(input, _mm256_set1_epi8('/')));
+        const __m256i values = _mm256_add_epi8(input, shift);
+        const __m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)),
+                                                 _mm256_set1_epi32(0x00011000));
+        const __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), join_lanes);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + done / 4 * 3), bytes);
+    }
+    return done;
+}
+
+#undef BASE64_SHIFT_LUT
+#undef BASE64_MASK_LUT
+#undef BASE64_BITPOS_LUT
+#undef BASE64_PACK_SHUFFLE
+#endif
+}
+
+std::string base64_encode(std::string_view data, SimdLevel level)
+{
+    std::string out((data.size() + 2) / 3 * 4, '\0');
+    const auto *in = reinterpret_cast<const unsigned char *>(data.data());
+    std::size_t done = 0;
+#ifdef CLIPBOARD_BASE64_X86
+    if (level >= SimdLevel::avx2)
+    {
+        done = encode_avx2(in, data.size(), out.data());
+    }
+    if (level >= SimdLevel::sse41)
+    {
+        done += encode_sse(in + done, data.size() - done, out.data() + done / 3 * 4);
+    }
+#else
+    (void)level;
+#endif
+    encode_scalar(in + done, data.size() - done, out.data() + done / 3 * 4);
+    return out;
+}
+
+std::optional<std::string> base64_decode(std::string_view encoded, SimdLevel level)
+{
+    if (encoded.size() % 4 != 0)
+    {
+        return std::nullopt;
+    }
+    std::string out(encoded.size() / 4 * 3 + decode_slack, '\0');
+    const auto *in = reinterpret_cast<const unsigned char *>(encoded.data());
+    std::size_t done = 0;
+#ifdef CLIPBOARD_BASE64_X86
+    if (level >= SimdLevel::avx2)
+    {
+        done = decode_avx2(in, encoded.size(), out.data());
+    }
+    if (level >= SimdLevel::sse41)
+    {
+        done += decode_sse(in + done, encoded.size() - done, out.data() + done / 4 * 3);
+    }
+#else
+    (void)level;
+#endif
+    const auto tail = decode_scalar(in + done, encoded.size() - done, out.data() + done / 4 * 3);
+    if (!tail)
+    {
+        return std::nullopt;
+    }
+    out.resize(done / 4 * 3 + *tail);
+    return out;
+}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Simd.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace clipboard
+{
+// Standard alphabet with '=' padding.
+std::string base64_encode(std::string_view data, SimdLevel level = best_simd_level());
+
+// Strict decoding: the input must be padded to a multiple of four, contain
+// only alphabet characters before the padding, and leave the unused bits of
+// the last group zero. Returns std::nullopt otherwise.
+std::optional<std::string> base64_decode(std::string_view encoded, SimdLevel level = best_simd_level());
+}
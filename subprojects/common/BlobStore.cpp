@@ -0,0 +1,296 @@
+#include "BlobStore.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace clipboard
+{
+namespace
+{
+constexpr const char *tmp_prefix = ".tmp.";
+}
+
+BlobWriter::~BlobWriter()
+{
+    discard();
+}
+
+BlobWriter::BlobWriter(BlobWriter &&other) noexcept
+    : directory(std::move(other.directory)), tmp_path(std::exchange(other.tmp_path, {})),
+      fd(std::move(other.fd)), written(std::exchange(other.written, 0)), hasher(other.hasher)
+{
+}
+
+BlobWriter &BlobWriter::operator=(BlobWriter &&other) noexcept
+{
+    if (this != &other)
+    {
+        discard();
+        directory = std::move(other.directory);
+        tmp_path = std::exchange(other.tmp_path, {});
+        fd = std::move(other.fd);
+        written = std::exchange(other.written, 0);
+        hasher = other.hasher;
+    }
+    return *this;
+}
+
+bool BlobWriter::open(const std::filesystem::path &blob_directory)
+{
+    discard();
+    directory = blob_directory;
+    try
+    {
+        std::filesystem::create_directories(directory);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Failed to create clipboard blob directory: " << e.what() << std::endl;
+        return false;
+    }
+
+    std::string tmp_name = (directory / tmp_prefix).string() + "XXXXXX";
+    fd.reset(mkostemp(tmp_name.data(), O_CLOEXEC));
+    if (!fd.valid())
+    {
+        perror("mkostemp");
+        return false;
+    }
+    fchmod(fd.get(), S_IRUSR | S_IWUSR);
+    tmp_path = tmp_name;
+    written = 0;
+    hasher = ContentHasher();
+    return true;
+}
+
+bool BlobWriter::write(std::string_view data)
+{
+    if (!write_all(fd.get(), data))
+    {
+        perror("write clipboard blob");
+        return false;
+    }
+    written += data.size();
+    hasher.update(data);
+    return true;
+}
+
+ssize_t BlobWriter::splice_from(int pipe_fd, std::size_t max_size)
+{
+    while (true)
+    {
+        ssize_t n = splice(pipe_fd, nullptr, fd.get(), nullptr, max_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return n;
+        }
+        // The spliced pages are still in the page cache; hashing them now
+        // spares commit() a pass over the whole file.
+        char buf[64 * 1024];
+        for (ssize_t hashed = 0; hashed < n;)
+        {
+            const auto chunk = std::min<std::size_t>(sizeof(buf), static_cast<std::size_t>(n - hashed));
+            const ssize_t got = pread(fd.get(), buf, chunk, static_cast<off_t>(written) + hashed);
+            if (got <= 0)
+            {
+                if (got < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                // The file now holds bytes the hash lacks.
+                perror("read back clipboard blob");
+                discard();
+                errno = EIO;
+                return -1;
+            }
+            hasher.update({buf, static_cast<std::size_t>(got)});
+            hashed += got;
+        }
+        written += static_cast<std::uint64_t>(n);
+        return n;
+    }
+}
+
+std::optional<Payload> BlobWriter::commit()
+{
+    if (!fd.valid())
+    {
+        return std::nullopt;
+    }
+    if (fdatasync(fd.get()) != 0)
+    {
+        perror("fdatasync clipboard blob");
+        return std::nullopt;
+    }
+    const auto hash = hasher.digest();
+    fd.reset();
+
+    const auto path = blob_path(directory, hash);
+    std::error_code error;
+    if (std::filesystem::exists(path, error))
+    {
+        std::filesystem::remove(tmp_path, error);
+    }
+    else
+    {
+        std::filesystem::rename(tmp_path, path, error);
+        if (error)
+        {
+            std::cerr << "Failed to store clipboard blob: " << error.message() << std::endl;
+            return std::nullopt;
+        }
+        UniqueFd dir_fd(::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (dir_fd.valid())
+        {
+            fsync(dir_fd.get());
+        }
+    }
+    tmp_path.clear();
+    return Payload::blob(path, hash, written);
+}
+
+std::optional<std::string> BlobWriter::read_back() const
+{
+    MappedFile contents;
+    if (tmp_path.empty() || !contents.open(tmp_path))
+    {
+        return std::nullopt;
+    }
+    return std::string(contents.data().substr(0, written));
+}
+
+void BlobWriter::discard()
+{
+    fd.reset();
+    if (!tmp_path.empty())
+    {
+        std::error_code error;
+        std::filesystem::remove(tmp_path, error);
+        tmp_path.clear();
+    }
+    written = 0;
+}
+
+BlobCommitter::BlobCommitter()
+{
+    event_fd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (!event_fd.valid())
+    {
+        perror("eventfd");
+    }
+    // As for LogWriter, signals stay with the owner's SignalFd.
+    sigset_t all;
+    sigset_t previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    thread = std::thread([this]
+                         { run(); });
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+BlobCommitter::~BlobCommitter()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        queued.clear();
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void BlobCommitter::commit(BlobWriter writer, bool summarize_text, Callback done)
+{
+    {
+        std::lock_guard lock(mutex);
+        queued.push_back({std::move(writer), summarize_text, std::move(done), {}});
+    }
+    wake.notify_one();
+}
+
+void BlobCommitter::run_callbacks()
+{
+    std::uint64_t count;
+    while (::read(event_fd.get(), &count, sizeof(count)) < 0 && errno == EINTR)
+    {
+    }
+    std::vector<Job> done;
+    {
+        std::lock_guard lock(mutex);
+        done = std::exchange(finished, {});
+    }
+    for (auto &job : done)
+    {
+        job.done(std::move(job.result));
+    }
+}
+
+void BlobCommitter::run()
+{
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]
+                  { return !queued.empty() || stopping; });
+        if (stopping)
+        {
+            break;
+        }
+        auto job = std::move(queued.front());
+        queued.pop_front();
+        lock.unlock();
+        auto &payload = job.result.payload;
+        payload = job.writer.commit();
+        if (!payload)
+        {
+            // Keep the bytes in memory rather than lose the MIME type.
+            if (auto contents = job.writer.read_back())
+            {
+                payload = Payload(std::move(*contents));
+            }
+            job.writer.discard();
+        }
+        MappedFile blob;
+        if (job.summarize_text && payload && (!payload->is_blob() || blob.open(payload->blob_path())))
+        {
+            job.result.text_summary = clipboard::summarize_text(payload->is_blob() ? blob.data() : payload->data());
+        }
+        lock.lock();
+        finished.push_back(std::move(job));
+        const std::uint64_t one = 1;
+        if (::write(event_fd.get(), &one, sizeof(one)) < 0)
+        {
+            perror("signal blob commit");
+        }
+    }
+}
+
+void remove_unreferenced_blobs(const std::filesystem::path &directory, const std::unordered_set<std::uint64_t> &live)
+{
+    std::error_code error;
+    for (const auto &file : std::filesystem::directory_iterator(directory, error))
+    {
+        const auto name = file.path().filename().string();
+        std::uint64_t hash = 0;
+        const auto [end, parse_error] = std::from_chars(name.data(), name.data() + name.size(), hash, 16);
+        if (parse_error != std::errc() || end != name.data() + name.size() || live.contains(hash))
+        {
+            continue;
+        }
+        std::filesystem::remove(file.path(), error);
+    }
+}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "ClipboardHistory.h"
+#include "ContentHash.h"
+#include "PosixIO.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace clipboard
+{
+// Streams one payload into a temporary file in a blob directory, hashing it
+// on the way. commit() names the file after its content hash, so equal
+// payloads share one file.
+class BlobWriter
+{
+public:
+    BlobWriter() = default;
+
+    BlobWriter(const BlobWriter &) = delete;
+    BlobWriter &operator=(const BlobWriter &) = delete;
+    BlobWriter(BlobWriter &&other) noexcept;
+    BlobWriter &operator=(BlobWriter &&other) noexcept;
+    ~BlobWriter();
+
+    bool open(const std::filesystem::path &directory);
+    bool is_open() const { return fd.valid(); }
+    bool write(std::string_view data);
+    // Moves up to max_size bytes from a pipe into the file without copying
+    // them through user space. Returns 0 at EOF and -1 with errno set on
+    // failure (EAGAIN when the pipe is drained).
+    ssize_t splice_from(int pipe_fd, std::size_t max_size);
+    std::uint64_t size() const { return written; }
+    // Syncs and renames the file, so it blocks on the disk. On failure the
+    // temporary file is kept until discard() or destruction.
+    std::optional<Payload> commit();
+    // The bytes written so far, read back from the temporary file.
+    std::optional<std::string> read_back() const;
+    void discard();
+
+private:
+    std::filesystem::path directory;
+    std::filesystem::path tmp_path;
+    UniqueFd fd;
+    std::uint64_t written = 0;
+    ContentHasher hasher;
+};
+
+// Commits BlobWriters on a background thread, so their fdatasync and rename
+// never stall the owner's event loop; summarizing a large text payload is
+// done there too. get() becomes readable once commits have finished;
+// run_callbacks() then hands each result to its callback on the calling
+// thread.
+class BlobCommitter
+{
+public:
+    struct Result
+    {
+        // The committed blob payload. If the commit fails, the bytes read
+        // back into an in-memory payload, or std::nullopt if those are lost
+        // too.
+        std::optional<Payload> payload;
+        // summarize_text of the payload, if it was asked for.
+        std::optional<EntrySummary> text_summary;
+    };
+    using Callback = std::function<void(Result)>;
+
+    BlobCommitter();
+    // Writers still queued are discarded and pending callbacks dropped.
+    ~BlobCommitter();
+
+    BlobCommitter(const BlobCommitter &) = delete;
+    BlobCommitter &operator=(const BlobCommitter &) = delete;
+
+    void commit(BlobWriter writer, bool summarize_text, Callback done);
+    void run_callbacks();
+    int get() const { return event_fd.get(); }
+
+private:
+    struct Job
+    {
+        BlobWriter writer;
+        bool summarize_text = false;
+        Callback done;
+        Result result;
+    };
+
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> queued;
+    std::vector<Job> finished;
+    bool stopping = false;
+    UniqueFd event_fd;
+    std::thread thread;
+};
+
+// Deletes blob files in directory whose hash is not in live. Temporary files
+// of writers still in progress are left alone.
+void remove_unreferenced_blobs(const std::filesystem::path &directory, const std::unordered_set<std::uint64_t> &live);
+}
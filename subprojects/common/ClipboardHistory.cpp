@@ -1,134 +1,45 @@
 #include "ClipboardHistory.h"
+#include "Base64.h"
+#include "ContentHash.h"
+#include "HistoryLog.h"
 #include "PosixIO.h"
+#include "StringUtils.h"
+#include "TextSearch.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
-#include <cctype>
-#include <fcntl.h>
+#include <format>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <nlohmann/json.hpp>
-#include <sys/stat.h>
-#include <unistd.h>
+#include <stdexcept>
 
 namespace clipboard
 {
 namespace
 {
-constexpr const char *history_file_name = "clipboard_history.json";
-constexpr const char *base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+constexpr const char *history_file_name = "clipboard_history.log";
+constexpr const char *primary_history_file_name = "primary_history.log";
+constexpr const char *legacy_history_file_name = "clipboard_history.json";
 
-bool is_base64(unsigned char c)
+std::size_t entries_within(const ClipboardHistory &history, const HistoryLimits &limits)
 {
-    return std::isalnum(c) || c == '+' || c == '/';
-}
-
-std::string base64_encode(const std::string &input)
-{
-    int in_len = static_cast<int>(input.size());
-    const unsigned char *bytes_to_encode = reinterpret_cast<const unsigned char *>(input.c_str());
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--)
-    {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3)
-        {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for (i = 0; i < 4; i++)
-            {
-                ret += base64_chars[char_array_4[i]];
-            }
-            i = 0;
-        }
-    }
-
-    if (i)
-    {
-        for (j = i; j < 3; j++)
-        {
-            char_array_3[j] = '\0';
-        }
-
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
-
-        for (j = 0; j < i + 1; j++)
-        {
-            ret += base64_chars[char_array_4[j]];
-        }
-        while (i++ < 3)
-        {
-            ret += '=';
-        }
-    }
-
-    return ret;
-}
-
-std::string base64_decode(const std::string &encoded_string)
-{
-    int in_len = static_cast<int>(encoded_string.size());
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
-
-    while (in_len-- && encoded_string[in_] != '=' && is_base64(encoded_string[in_]))
-    {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4)
-        {
-            for (i = 0; i < 4; i++)
-            {
-                char_array_4[i] = static_cast<unsigned char>(std::string(base64_chars).find(char_array_4[i]));
-            }
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; i < 3; i++)
-            {
-                ret += char_array_3[i];
-            }
-            i = 0;
-        }
-    }
-
-    if (i)
+    std::uint64_t bytes = 0;
+    for (std::size_t i = 0; i < history.size(); ++i)
     {
-        for (j = i; j < 4; j++)
+        for (const auto &[mime, payload] : history[i])
         {
-            char_array_4[j] = 0;
+            bytes += payload.size();
         }
-        for (j = 0; j < 4; j++)
+        if (i > 0 && (i >= limits.max_entries || bytes > limits.max_bytes))
         {
-            char_array_4[j] = static_cast<unsigned char>(std::string(base64_chars).find(char_array_4[j]));
-        }
-
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-        for (j = 0; j < i - 1; j++)
-        {
-            ret += char_array_3[j];
+            return i;
         }
     }
-
-    return ret;
+    return history.size();
 }
 
 std::filesystem::path data_home()
@@ -166,7 +77,13 @@ ClipboardHistory decode_history(const nlohmann::json &json_data)
             {
                 continue;
             }
-            entry[it.key()] = base64_decode(it.value().get<std::string>());
+            auto payload = base64_decode(it.value().get<std::string>());
+            if (!payload)
+            {
+                std::cerr << "Skipping invalid base64 payload for " << it.key() << " in legacy history" << std::endl;
+                continue;
+            }
+            entry.insert_or_assign(it.key(), std::move(*payload));
         }
         if (!entry.empty())
         {
@@ -178,143 +95,350 @@ ClipboardHistory decode_history(const nlohmann::json &json_data)
     return history;
 }
 
-nlohmann::json encode_history(const ClipboardHistory &history)
+ClipboardHistory load_legacy_history()
 {
-    nlohmann::json json_data = nlohmann::json::array();
-    for (const auto &entry : history)
+    const auto path = legacy_history_path();
+    std::ifstream file(path);
+    if (!file.is_open())
     {
-        nlohmann::json encoded_entry = nlohmann::json::object();
-        for (const auto &[mime, data] : entry)
-        {
-            encoded_entry[mime] = base64_encode(data);
-        }
-        if (!encoded_entry.empty())
-        {
-            json_data.push_back(std::move(encoded_entry));
-        }
+        return {};
+    }
+
+    try
+    {
+        nlohmann::json json_data;
+        file >> json_data;
+        return decode_history(json_data);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Ignoring invalid clipboard history at " << path << ": " << e.what() << std::endl;
+        return {};
     }
-    return json_data;
 }
 }
 
-std::filesystem::path history_path()
+// The stored form of a compressed payload, owned or in a mapped log, and
+// its decoding once something has read it.
+class CompressedBytes
 {
-    const auto dir = data_home();
-    if (dir.empty())
+public:
+    CompressedBytes(std::string owned, std::shared_ptr<const MappedFile> mapping, std::string_view stored, Codec codec,
+                    std::uint64_t size)
+        : owned(std::move(owned)), mapping(std::move(mapping)), stored(this->mapping ? stored : this->owned),
+          codec(codec), size(size) {}
+
+    std::string_view bytes() const { return stored; }
+    Codec codec_used() const { return codec; }
+
+    std::string_view decoded() const
     {
-        return {};
+        std::call_once(decode_once, [this]
+                       {
+                           if (auto data = decompress_payload(codec, stored, size))
+                           {
+                               decoded_bytes = std::move(*data);
+                           }
+                           else
+                           {
+                               std::cerr << "Failed to decompress clipboard payload" << std::endl;
+                           } });
+        return decoded_bytes;
     }
-    return dir / history_file_name;
+
+private:
+    std::string owned;
+    std::shared_ptr<const MappedFile> mapping;
+    std::string_view stored;
+    Codec codec;
+    std::uint64_t size;
+    mutable std::once_flag decode_once;
+    mutable std::string decoded_bytes;
+};
+
+Payload Payload::blob(std::filesystem::path path, std::uint64_t hash, std::uint64_t size)
+{
+    Payload payload;
+    payload.blob_path_ = std::move(path);
+    payload.hash_ = hash;
+    payload.blob_size_ = size;
+    return payload;
+}
+
+Payload Payload::mapped(std::shared_ptr<const MappedFile> file, std::string_view data, std::uint64_t hash)
+{
+    Payload payload;
+    payload.mapping_ = std::move(file);
+    payload.mapped_ = data;
+    payload.hash_ = hash;
+    return payload;
 }
 
-void trim_history(ClipboardHistory &history)
+Payload Payload::compressed(std::string data, Codec codec, std::uint64_t size, std::uint64_t hash)
 {
-    if (history.size() > max_history_size)
+    Payload payload;
+    payload.compressed_ = std::make_shared<const CompressedBytes>(std::move(data), nullptr, std::string_view(), codec, size);
+    payload.hash_ = hash;
+    payload.blob_size_ = size;
+    return payload;
+}
+
+Payload Payload::compressed(std::shared_ptr<const MappedFile> file, std::string_view data, Codec codec,
+                            std::uint64_t size, std::uint64_t hash)
+{
+    Payload payload;
+    payload.compressed_ = std::make_shared<const CompressedBytes>(std::string(), std::move(file), data, codec, size);
+    payload.hash_ = hash;
+    payload.blob_size_ = size;
+    return payload;
+}
+
+Codec Payload::codec() const
+{
+    return compressed_ ? compressed_->codec_used() : Codec::none;
+}
+
+std::string_view Payload::compressed_data() const
+{
+    return compressed_ ? compressed_->bytes() : std::string_view();
+}
+
+std::string_view Payload::decompressed() const
+{
+    return compressed_->decoded();
+}
+
+std::uint64_t Payload::hash() const
+{
+    return is_blob() || mapping_ || compressed_ ? hash_ : content_hash(data_);
+}
+
+std::string Payload::load() const
+{
+    if (!is_blob())
     {
-        history.resize(max_history_size);
+        return std::string(data());
     }
+    std::ifstream file(blob_path_, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
 }
 
-ClipboardHistory load_history()
+bool operator==(const Payload &a, const Payload &b)
 {
-    const auto path = history_path();
-    if (path.empty())
+    if (a.size() != b.size())
     {
-        std::cerr << "Cannot load clipboard history: XDG_DATA_HOME and HOME are unset" << std::endl;
-        return {};
+        return false;
+    }
+    if ((a.is_blob() || a.is_compressed()) && (b.is_blob() || b.is_compressed()))
+    {
+        return a.hash_ == b.hash_;
     }
+    if (!a.is_blob() && !b.is_blob())
+    {
+        return a.data() == b.data();
+    }
+    return a.load() == b.load();
+}
 
-    std::ifstream file(path);
-    if (!file.is_open())
+ClipboardEntry::ClipboardEntry(std::initializer_list<std::pair<std::string_view, Payload>> items)
+{
+    reserve(items.size());
+    for (const auto &[mime, payload] : items)
     {
-        return {};
+        insert_or_assign(mime, payload);
     }
+}
 
-    try
+ClipboardEntry::const_iterator ClipboardEntry::find(MimeId mime) const
+{
+    return std::ranges::find(payloads, mime, &value_type::first);
+}
+
+ClipboardEntry::const_iterator ClipboardEntry::find(std::string_view mime) const
+{
+    const auto id = find_mime(mime);
+    return id ? find(*id) : end();
+}
+
+const Payload &ClipboardEntry::at(MimeId mime) const
+{
+    const auto it = find(mime);
+    if (it == end())
     {
-        nlohmann::json json_data;
-        file >> json_data;
-        return decode_history(json_data);
+        throw std::out_of_range("clipboard entry has no " + mime_name(mime) + " payload");
     }
-    catch (const std::exception &e)
+    return it->second;
+}
+
+const Payload &ClipboardEntry::at(std::string_view mime) const
+{
+    const auto it = find(mime);
+    if (it == end())
     {
-        std::cerr << "Ignoring invalid clipboard history at " << path << ": " << e.what() << std::endl;
-        return {};
+        throw std::out_of_range("clipboard entry has no " + std::string(mime) + " payload");
     }
+    return it->second;
 }
 
-bool save_history(const ClipboardHistory &history)
+void ClipboardEntry::insert_or_assign(MimeId mime, Payload payload)
 {
-    const auto path = history_path();
-    if (path.empty())
+    const MimeNames names;
+    const auto it = std::ranges::lower_bound(payloads, names[mime], {}, [&names](const value_type &item) -> const std::string &
+                                             { return names[item.first]; });
+    if (it != payloads.end() && it->first == mime)
     {
-        std::cerr << "Cannot save clipboard history: XDG_DATA_HOME and HOME are unset" << std::endl;
-        return false;
+        it->second = std::move(payload);
+        return;
     }
+    payloads.emplace(it, mime, std::move(payload));
+}
 
-    try
+std::filesystem::path history_path()
+{
+    const auto dir = data_home();
+    if (dir.empty())
     {
-        std::filesystem::create_directories(path.parent_path());
+        return {};
     }
-    catch (const std::exception &e)
+    return dir / history_file_name;
+}
+
+std::filesystem::path primary_history_path()
+{
+    const auto dir = data_home();
+    if (dir.empty())
     {
-        std::cerr << "Failed to create clipboard history directory: " << e.what() << std::endl;
-        return false;
+        return {};
     }
+    return dir / primary_history_file_name;
+}
 
-    auto tmp_template = path;
-    tmp_template += ".tmp.XXXXXX";
-    std::string tmp_name = tmp_template.string();
-    UniqueFd fd(mkstemp(tmp_name.data()));
-    if (!fd.valid())
+std::filesystem::path legacy_history_path()
+{
+    const auto dir = data_home();
+    if (dir.empty())
     {
-        perror("mkstemp");
-        return false;
+        return {};
     }
+    return dir / legacy_history_file_name;
+}
 
-    bool ok = true;
-    chmod(tmp_name.c_str(), S_IRUSR | S_IWUSR);
+std::filesystem::path blob_directory(const std::filesystem::path &log_path)
+{
+    auto directory = log_path;
+    directory.replace_extension(".blobs");
+    return directory;
+}
 
-    auto bounded_history = history;
-    trim_history(bounded_history);
-    const auto json_data = encode_history(bounded_history).dump();
-    ok = write_all(fd.get(), json_data) && fsync(fd.get()) == 0;
+std::filesystem::path blob_path(const std::filesystem::path &directory, std::uint64_t hash)
+{
+    return directory / std::format("{:016x}", hash);
+}
 
-    if (!ok)
+EntryDigest make_entry_digest(std::vector<std::pair<MimeId, std::uint64_t>> payloads)
+{
+    std::string key;
+    for (const auto &[mime, hash] : payloads)
     {
-        perror("write clipboard history");
+        key += mime_name(mime);
+        key += '\0';
+        key.append(reinterpret_cast<const char *>(&hash), sizeof(hash));
     }
+    return {.hash = content_hash(key), .payloads = std::move(payloads), .summary = {}};
+}
 
-    if (fd.valid() && close(fd.release()) != 0)
+EntryDigest digest_entry(const ClipboardEntry &entry, std::optional<EntrySummary> text_summary)
+{
+    std::vector<std::pair<MimeId, std::uint64_t>> payloads;
+    payloads.reserve(entry.size());
+    for (const auto &[mime, payload] : entry)
     {
-        perror("close clipboard history");
-        ok = false;
+        payloads.emplace_back(mime, payload.hash());
     }
+    auto digest = make_entry_digest(std::move(payloads));
+    digest.summary = summarize_entry(entry, std::move(text_summary));
+    return digest;
+}
 
-    if (!ok)
+EntrySummary summarize_entry(const ClipboardEntry &entry, std::optional<EntrySummary> text_summary)
+{
+    EntrySummary summary;
+    if (text_summary)
     {
-        std::filesystem::remove(tmp_name);
-        std::cerr << "Failed to write clipboard history temp file: " << tmp_name << std::endl;
-        return false;
+        summary = std::move(*text_summary);
+    }
+    else if (const auto text = entry.find(text_plain_mime); text != entry.end())
+    {
+        MappedFile blob;
+        if (!text->second.is_blob())
+        {
+            summary = summarize_text(text->second.data());
+        }
+        else if (blob.open(text->second.blob_path()))
+        {
+            summary = summarize_text(blob.data());
+        }
+    }
+    summary.captured_at = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count();
+    return summary;
+}
+
+EntrySummary summarize_text(std::string_view text)
+{
+    EntrySummary summary;
+    summary.preview = single_line_preview(text);
+    summary.trigrams = trigram_filter(text);
+    return summary;
+}
+
+void trim_history(ClipboardHistory &history, const HistoryLimits &limits)
+{
+    history.resize(entries_within(history, limits));
+}
+
+ClipboardHistory load_history()
+{
+    const auto path = history_path();
+    if (path.empty())
+    {
+        std::cerr << "Cannot load clipboard history: XDG_DATA_HOME and HOME are unset" << std::endl;
+        return {};
     }
 
     try
     {
-        std::filesystem::rename(tmp_name, path);
-        chmod(path.c_str(), S_IRUSR | S_IWUSR);
-        UniqueFd dir_fd(open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY));
-        if (dir_fd.valid())
+        auto replay = replay_history_log(path);
+        if (!replay)
         {
-            fsync(dir_fd.get());
+            return load_legacy_history();
         }
+        return std::move(replay->history);
     }
     catch (const std::exception &e)
     {
-        std::filesystem::remove(tmp_name);
-        std::cerr << "Failed to replace clipboard history: " << e.what() << std::endl;
+        std::cerr << "Ignoring invalid clipboard history at " << path << ": " << e.what() << std::endl;
+        return {};
+    }
+}
+
+bool save_history(const ClipboardHistory &history, const HistoryLimits &limits)
+{
+    const auto path = history_path();
+    if (path.empty())
+    {
+        std::cerr << "Cannot save clipboard history: XDG_DATA_HOME and HOME are unset" << std::endl;
         return false;
     }
 
-    return true;
+    const auto count = entries_within(history, limits);
+    std::vector<EntryDigest> digests;
+    digests.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        digests.push_back(digest_entry(history[i]));
+    }
+    return write_history_log(path, history, digests);
 }
 }
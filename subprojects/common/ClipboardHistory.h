@@ -1,19 +1,168 @@
 #pragma once
 
+#include "MimeType.h"
+#include "PayloadCodec.h"
+
+#include <cstdint>
 #include <filesystem>
-#include <map>
+#include <initializer_list>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace clipboard
 {
-using ClipboardEntry = std::map<std::string, std::string>;
+class MappedFile;
+class CompressedBytes;
+
+// A captured MIME payload: either the bytes themselves, or a reference to a
+// content-addressed blob file for payloads too large to keep in memory.
+// Payloads replayed from the history log stay in the log's mapping, so
+// loading a history does not copy payload bytes until something reads them.
+// Compressed payloads are decoded on the first data() call; copies share
+// the decoded bytes.
+class Payload
+{
+public:
+    Payload() = default;
+    Payload(std::string data) : data_(std::move(data)) {}
+    Payload(const char *data) : data_(data) {}
+    static Payload blob(std::filesystem::path path, std::uint64_t hash, std::uint64_t size);
+    // data points into file, which the payload keeps mapped.
+    static Payload mapped(std::shared_ptr<const MappedFile> file, std::string_view data, std::uint64_t hash);
+    // data is the codec's output for size bytes hashing to hash.
+    static Payload compressed(std::string data, Codec codec, std::uint64_t size, std::uint64_t hash);
+    static Payload compressed(std::shared_ptr<const MappedFile> file, std::string_view data, Codec codec,
+                              std::uint64_t size, std::uint64_t hash);
+
+    bool is_blob() const { return !blob_path_.empty(); }
+    const std::filesystem::path &blob_path() const { return blob_path_; }
+    bool is_compressed() const { return compressed_ != nullptr; }
+    // data() points into a file mapping, which is never modified in place.
+    bool is_mapped() const { return mapping_ != nullptr; }
+    Codec codec() const;
+    // The stored bytes of a compressed payload; empty otherwise.
+    std::string_view compressed_data() const;
+    // Uncompressed size.
+    std::uint64_t size() const { return is_blob() || is_compressed() ? blob_size_ : data().size(); }
+    bool empty() const { return size() == 0; }
+    std::uint64_t hash() const;
+    // Inline bytes; empty for blob payloads, and for compressed payloads
+    // that fail to decode.
+    std::string_view data() const
+    {
+        return compressed_ ? decompressed() : mapping_ ? mapped_ : std::string_view(data_);
+    }
+    // Inline bytes, or the blob file's contents read from disk.
+    std::string load() const;
+
+    friend bool operator==(const Payload &a, const Payload &b);
+
+private:
+    std::string data_;
+    std::shared_ptr<const MappedFile> mapping_;
+    std::string_view mapped_;
+    std::shared_ptr<const CompressedBytes> compressed_;
+    std::filesystem::path blob_path_;
+    // Known up front for blob, mapped and compressed payloads.
+    std::uint64_t hash_ = 0;
+    // Uncompressed size of blob and compressed payloads.
+    std::uint64_t blob_size_ = 0;
+
+    std::string_view decompressed() const;
+};
+
+// The payloads of one entry keyed by interned MIME type. A flat vector kept
+// in MIME name order, which is the order entry hashes and log records list
+// them in; entries carry a handful of types, so lookups scan it.
+class ClipboardEntry
+{
+public:
+    using value_type = std::pair<MimeId, Payload>;
+    using const_iterator = std::vector<value_type>::const_iterator;
+
+    ClipboardEntry() = default;
+    ClipboardEntry(std::initializer_list<std::pair<std::string_view, Payload>> items);
+
+    std::size_t size() const { return payloads.size(); }
+    bool empty() const { return payloads.empty(); }
+    const_iterator begin() const { return payloads.begin(); }
+    const_iterator end() const { return payloads.end(); }
+    void reserve(std::size_t size) { payloads.reserve(size); }
+    void clear() { payloads.clear(); }
+
+    const_iterator find(MimeId mime) const;
+    const_iterator find(std::string_view mime) const;
+    // Throw std::out_of_range if the entry has no payload of that type.
+    const Payload &at(MimeId mime) const;
+    const Payload &at(std::string_view mime) const;
+    // Replaces any payload of the same type.
+    void insert_or_assign(MimeId mime, Payload payload);
+    void insert_or_assign(std::string_view mime, Payload payload) { insert_or_assign(intern_mime(mime), std::move(payload)); }
+
+    friend bool operator==(const ClipboardEntry &a, const ClipboardEntry &b) = default;
+
+private:
+    std::vector<value_type> payloads;
+};
+
 using ClipboardHistory = std::vector<ClipboardEntry>;
 
-constexpr std::size_t max_history_size = 25;
+// Eviction drops the least recently copied or restored entries until the
+// history fits both limits. The newest entry is always kept.
+struct HistoryLimits
+{
+    std::size_t max_entries = 25;
+    // Payload bytes, inline and in blob files, counting shared payloads once.
+    std::uint64_t max_bytes = 512 * 1024 * 1024;
+};
+
+// What listing an entry needs beyond its MIME types and sizes, computed once
+// at capture so the picker never reads payload bytes.
+struct EntrySummary
+{
+    // Milliseconds since the Unix epoch; 0 when unknown.
+    std::int64_t captured_at = 0;
+    // single_line_preview of the text/plain payload; empty without one.
+    std::string preview;
+    // trigram_filter of the text/plain payload; empty without one.
+    std::string trigrams;
+    // Some payloads were cut short: their source stalled or exceeded the
+    // size limit.
+    bool partial = false;
+};
+
+// Content hashes of an entry: one per MIME payload, in entry order, and one
+// over all (MIME type, payload hash) pairs identifying the whole entry. The
+// summary is stored with the hashes but is not part of the entry's identity.
+struct EntryDigest
+{
+    std::uint64_t hash = 0;
+    std::vector<std::pair<MimeId, std::uint64_t>> payloads;
+    EntrySummary summary;
+};
+
+EntryDigest make_entry_digest(std::vector<std::pair<MimeId, std::uint64_t>> payloads);
+// Hashes the entry and summarizes it as captured now. A text_summary from
+// summarize_text stands in for summarizing the text/plain payload, which for
+// a blob means reading all of it.
+EntryDigest digest_entry(const ClipboardEntry &entry, std::optional<EntrySummary> text_summary = std::nullopt);
+EntrySummary summarize_entry(const ClipboardEntry &entry, std::optional<EntrySummary> text_summary = std::nullopt);
+// The preview and trigram filter of a text/plain payload.
+EntrySummary summarize_text(std::string_view text);
 
 std::filesystem::path history_path();
+// History of the primary selection, kept apart from the clipboard's.
+std::filesystem::path primary_history_path();
+std::filesystem::path legacy_history_path();
+// Directory holding the blob files referenced by the log at log_path.
+std::filesystem::path blob_directory(const std::filesystem::path &log_path);
+std::filesystem::path blob_path(const std::filesystem::path &directory, std::uint64_t hash);
 ClipboardHistory load_history();
-bool save_history(const ClipboardHistory &history);
-void trim_history(ClipboardHistory &history);
+bool save_history(const ClipboardHistory &history, const HistoryLimits &limits = {});
+// Without hashes at hand, payloads shared between entries count once per entry.
+void trim_history(ClipboardHistory &history, const HistoryLimits &limits = {});
 }
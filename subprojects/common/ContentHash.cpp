@@ -0,0 +1,156 @@
+#include "ContentHash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace clipboard
+{
+namespace
+{
+constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t prime3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+std::uint64_t read64(const char *p)
+{
+    std::uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+std::uint32_t read32(const char *p)
+{
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+std::uint64_t round(std::uint64_t acc, std::uint64_t input)
+{
+    acc += input * prime2;
+    acc = std::rotl(acc, 31);
+    return acc * prime1;
+}
+
+std::uint64_t merge_round(std::uint64_t acc, std::uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * prime1 + prime4;
+}
+
+std::uint64_t merge_lanes(const std::uint64_t (&lanes)[4])
+{
+    std::uint64_t hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+    for (const auto lane : lanes)
+    {
+        hash = merge_round(hash, lane);
+    }
+    return hash;
+}
+
+// Mixes in the final 0 to 31 bytes and avalanches the result.
+std::uint64_t finish(std::uint64_t hash, const char *p, const char *const end)
+{
+    while (end - p >= 8)
+    {
+        hash ^= round(0, read64(p));
+        hash = std::rotl(hash, 27) * prime1 + prime4;
+        p += 8;
+    }
+    if (end - p >= 4)
+    {
+        hash ^= static_cast<std::uint64_t>(read32(p)) * prime1;
+        hash = std::rotl(hash, 23) * prime2 + prime3;
+        p += 4;
+    }
+    while (p < end)
+    {
+        hash ^= static_cast<std::uint64_t>(static_cast<unsigned char>(*p)) * prime5;
+        hash = std::rotl(hash, 11) * prime1;
+        ++p;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Consumes whole 32-byte stripes from p and returns where it stopped.
+const char *consume_stripes(std::uint64_t (&lanes)[4], const char *p, const char *const end)
+{
+    while (end - p >= 32)
+    {
+        lanes[0] = round(lanes[0], read64(p));
+        lanes[1] = round(lanes[1], read64(p + 8));
+        lanes[2] = round(lanes[2], read64(p + 16));
+        lanes[3] = round(lanes[3], read64(p + 24));
+        p += 32;
+    }
+    return p;
+}
+}
+
+std::uint64_t content_hash(std::string_view data, std::uint64_t seed)
+{
+    const char *p = data.data();
+    const char *const end = p + data.size();
+    std::uint64_t hash;
+
+    if (data.size() >= 32)
+    {
+        std::uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        p = consume_stripes(lanes, p, end);
+        hash = merge_lanes(lanes);
+    }
+    else
+    {
+        hash = seed + prime5;
+    }
+
+    return finish(hash + data.size(), p, end);
+}
+
+ContentHasher::ContentHasher(std::uint64_t seed)
+    : seed(seed), lanes{seed + prime1 + prime2, seed + prime2, seed, seed - prime1}
+{
+}
+
+void ContentHasher::update(std::string_view data)
+{
+    if (data.empty())
+    {
+        return;
+    }
+    const char *p = data.data();
+    const char *const end = p + data.size();
+    total += data.size();
+    if (pending_size > 0)
+    {
+        const auto taken = std::min<std::size_t>(sizeof(pending) - pending_size, data.size());
+        std::memcpy(pending + pending_size, p, taken);
+        pending_size += taken;
+        p += taken;
+        if (pending_size < sizeof(pending))
+        {
+            return;
+        }
+        consume_stripes(lanes, pending, pending + sizeof(pending));
+        pending_size = 0;
+    }
+    p = consume_stripes(lanes, p, end);
+    std::memcpy(pending, p, static_cast<std::size_t>(end - p));
+    pending_size = static_cast<std::size_t>(end - p);
+}
+
+std::uint64_t ContentHasher::digest() const
+{
+    const std::uint64_t hash = total >= 32 ? merge_lanes(lanes) : seed + prime5;
+    return finish(hash + total, pending, pending + pending_size);
+}
+}
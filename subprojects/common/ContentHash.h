@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace clipboard
+{
+// XXH64 of data. Used to identify clipboard payloads; it is fast, not
+// cryptographic.
+std::uint64_t content_hash(std::string_view data, std::uint64_t seed = 0);
+
+// content_hash of data fed in pieces, for payloads that never sit in memory
+// as a whole.
+class ContentHasher
+{
+public:
+    explicit ContentHasher(std::uint64_t seed = 0);
+
+    void update(std::string_view data);
+    // The content_hash of everything passed to update() so far.
+    std::uint64_t digest() const;
+
+private:
+    std::uint64_t seed;
+    std::uint64_t lanes[4];
+    std::uint64_t total = 0;
+    // Input not yet consumed by a full 32-byte stripe.
+    char pending[32];
+    std::size_t pending_size = 0;
+};
+}
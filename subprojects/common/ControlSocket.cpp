@@ -0,0 +1,278 @@
+#include "ControlSocket.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace clipboard
+{
+namespace
+{
+constexpr std::size_t max_request_size = 4096;
+constexpr std::string_view select_command = "select ";
+
+bool make_address(const std::filesystem::path &path, sockaddr_un &address)
+{
+    const auto &name = path.native();
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (name.empty() || name.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Invalid control socket path " << path << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, name.c_str(), name.size() + 1);
+    return true;
+}
+
+UniqueFd connect_to(const std::filesystem::path &path)
+{
+    sockaddr_un address;
+    if (!make_address(path, address))
+    {
+        return {};
+    }
+    UniqueFd fd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (!fd.valid() || connect(fd.get(), reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        return {};
+    }
+    return fd;
+}
+
+template <typename T>
+bool parse_number(std::string_view text, T &value, int base)
+{
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    return error == std::errc() && end == text.data() + text.size();
+}
+}
+
+std::filesystem::path control_socket_path()
+{
+    const char *runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir || !*runtime_dir)
+    {
+        return {};
+    }
+    // One watcher runs per Wayland display.
+    const char *display = std::getenv("WAYLAND_DISPLAY");
+    const auto display_name = std::filesystem::path(display && *display ? display : "wayland-0").filename();
+    return std::filesystem::path(runtime_dir) / std::format("wl-copy-slurp-{}.sock", display_name.string());
+}
+
+std::string encode_select_request(std::size_t index, std::uint64_t entry_hash)
+{
+    return std::format("select {} {:016x}", index, entry_hash);
+}
+
+bool decode_select_request(std::string_view request, std::size_t &index, std::uint64_t &entry_hash)
+{
+    if (!request.starts_with(select_command))
+    {
+        return false;
+    }
+    request.remove_prefix(select_command.size());
+    const auto space = request.find(' ');
+    if (space == std::string_view::npos)
+    {
+        return false;
+    }
+    return parse_number(request.substr(0, space), index, 10) && parse_number(request.substr(space + 1), entry_hash, 16);
+}
+
+std::optional<std::string> send_control_request(const std::filesystem::path &path, std::string_view request,
+                                                std::chrono::milliseconds timeout)
+{
+    UniqueFd fd = connect_to(path);
+    if (!fd.valid())
+    {
+        return std::nullopt;
+    }
+
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(timeout - seconds);
+    timeval tv{.tv_sec = static_cast<time_t>(seconds.count()), .tv_usec = static_cast<suseconds_t>(micros.count())};
+    setsockopt(fd.get(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd.get(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string line(request);
+    line += '\n';
+    if (!write_all(fd.get(), line))
+    {
+        return std::nullopt;
+    }
+
+    std::string reply;
+    char buffer[256];
+    while (reply.find('\n') == std::string::npos && reply.size() < max_request_size)
+    {
+        ssize_t n = read(fd.get(), buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        reply.append(buffer, static_cast<std::size_t>(n));
+    }
+    const auto end = reply.find('\n');
+    if (end == std::string::npos)
+    {
+        return std::nullopt;
+    }
+    reply.resize(end);
+    return reply;
+}
+
+bool ControlServer::listen(const std::filesystem::path &socket_path, Handler request_handler)
+{
+    close();
+    sockaddr_un address;
+    if (!make_address(socket_path, address))
+    {
+        return false;
+    }
+    if (connect_to(socket_path).valid())
+    {
+        std::cerr << "Another process is listening on " << socket_path << std::endl;
+        return false;
+    }
+    // Left behind by a watcher that did not exit cleanly.
+    unlink(socket_path.c_str());
+
+    listen_fd.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if (!listen_fd.valid())
+    {
+        perror("socket");
+        return false;
+    }
+    const auto old_mask = umask(S_IRWXG | S_IRWXO);
+    const bool bound = bind(listen_fd.get(), reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+    umask(old_mask);
+    if (!bound || ::listen(listen_fd.get(), SOMAXCONN) != 0)
+    {
+        perror("bind control socket");
+        listen_fd.reset();
+        return false;
+    }
+    path = socket_path;
+    handler = std::move(request_handler);
+
+    if (!loop.add(listen_fd.get(), EPOLLIN, [this](std::uint32_t)
+                  { accept_clients(); }))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ControlServer::close()
+{
+    for (const auto &[fd, client] : clients)
+    {
+        loop.remove(fd);
+    }
+    clients.clear();
+    if (listen_fd.valid())
+    {
+        loop.remove(listen_fd.get());
+        listen_fd.reset();
+        unlink(path.c_str());
+    }
+    path.clear();
+}
+
+void ControlServer::accept_clients()
+{
+    while (true)
+    {
+        UniqueFd fd(accept4(listen_fd.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+        if (!fd.valid())
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+            return;
+        }
+        const int key = fd.get();
+        if (!loop.add(key, EPOLLIN, [this, key](std::uint32_t)
+                      { read_client(key); }))
+        {
+            continue;
+        }
+        clients[key].fd = std::move(fd);
+    }
+}
+
+void ControlServer::read_client(int fd)
+{
+    const auto it = clients.find(fd);
+    if (it == clients.end())
+    {
+        return;
+    }
+    auto &client = it->second;
+
+    char buffer[512];
+    while (true)
+    {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (n <= 0)
+        {
+            drop_client(fd);
+            return;
+        }
+        client.request.append(buffer, static_cast<std::size_t>(n));
+
+        const auto end = client.request.find('\n');
+        if (end != std::string::npos)
+        {
+            auto reply = handler(std::string_view(client.request).substr(0, end));
+            reply += '\n';
+            // Replies are a short line, which always fits the socket buffer.
+            if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+            {
+                perror("send control reply");
+            }
+            drop_client(fd);
+            return;
+        }
+        if (client.request.size() > max_request_size)
+        {
+            drop_client(fd);
+            return;
+        }
+    }
+}
+
+void ControlServer::drop_client(int fd)
+{
+    loop.remove(fd);
+    clients.erase(fd);
+}
+}
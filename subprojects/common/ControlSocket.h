@@ -0,0 +1,62 @@
+#pragma once
+
+#include "EventLoop.h"
+#include "PosixIO.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace clipboard
+{
+// The watcher's control socket takes one request line per connection and
+// answers with one line, "ok" or "error <reason>".
+std::filesystem::path control_socket_path();
+
+// Asks the watcher to set the selection to a history entry. The hash guards
+// against the history changing between reading it and sending the request.
+std::string encode_select_request(std::size_t index, std::uint64_t entry_hash);
+bool decode_select_request(std::string_view request, std::size_t &index, std::uint64_t &entry_hash);
+
+// Returns the reply line, or std::nullopt when no watcher answered in time.
+std::optional<std::string> send_control_request(const std::filesystem::path &path, std::string_view request,
+                                                std::chrono::milliseconds timeout);
+
+class ControlServer
+{
+public:
+    using Handler = std::function<std::string(std::string_view request)>;
+
+    explicit ControlServer(EventLoop &loop) : loop(loop) {}
+    ~ControlServer() { close(); }
+
+    ControlServer(const ControlServer &) = delete;
+    ControlServer &operator=(const ControlServer &) = delete;
+
+    // Fails when another process is already listening at path.
+    bool listen(const std::filesystem::path &path, Handler handler);
+    void close();
+
+private:
+    struct Client
+    {
+        UniqueFd fd;
+        std::string request;
+    };
+
+    EventLoop &loop;
+    std::filesystem::path path;
+    UniqueFd listen_fd;
+    Handler handler;
+    std::unordered_map<int, Client> clients;
+
+    void accept_clients();
+    void read_client(int fd);
+    void drop_client(int fd);
+};
+}
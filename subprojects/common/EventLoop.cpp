@@ -0,0 +1,187 @@
+#include "EventLoop.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace clipboard
+{
+namespace
+{
+constexpr int max_events = 16;
+
+timespec to_timespec(std::chrono::milliseconds duration)
+{
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration - seconds);
+    return {.tv_sec = static_cast<time_t>(seconds.count()), .tv_nsec = static_cast<long>(nanoseconds.count())};
+}
+}
+
+bool EventLoop::initialize()
+{
+    epoll_fd.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (!epoll_fd.valid())
+    {
+        perror("epoll_create1");
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::add(int fd, std::uint32_t events, Handler handler)
+{
+    const auto token = next_token++;
+    epoll_event event{.events = events, .data = {.u64 = token}};
+    if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        perror("epoll_ctl");
+        return false;
+    }
+    tokens[fd] = token;
+    handlers[token] = std::make_shared<Handler>(std::move(handler));
+    return true;
+}
+
+bool EventLoop::modify(int fd, std::uint32_t events)
+{
+    const auto token = tokens.find(fd);
+    if (token == tokens.end())
+    {
+        return false;
+    }
+    epoll_event event{.events = events, .data = {.u64 = token->second}};
+    if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_MOD, fd, &event) != 0)
+    {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::remove(int fd)
+{
+    const auto token = tokens.find(fd);
+    if (token == tokens.end())
+    {
+        return;
+    }
+    epoll_ctl(epoll_fd.get(), EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(token->second);
+    tokens.erase(token);
+}
+
+bool EventLoop::run_once(int timeout_ms)
+{
+    epoll_event events[max_events];
+    const int count = epoll_wait(epoll_fd.get(), events, max_events, timeout_ms);
+    if (count < 0)
+    {
+        if (errno == EINTR)
+        {
+            return true;
+        }
+        perror("epoll_wait");
+        return false;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        // Tokens are never reused, so events for a registration removed by an
+        // earlier handler in this batch are dropped even if its fd was reused.
+        const auto handler = handlers.find(events[i].data.u64);
+        if (handler == handlers.end())
+        {
+            continue;
+        }
+        const auto callback = handler->second;
+        (*callback)(events[i].events);
+    }
+    return true;
+}
+
+bool TimerFd::create()
+{
+    fd.reset(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    if (!fd.valid())
+    {
+        perror("timerfd_create");
+        return false;
+    }
+    return true;
+}
+
+bool TimerFd::arm(std::chrono::milliseconds initial, std::chrono::milliseconds interval)
+{
+    // A zero it_value would disarm the timer instead of firing immediately.
+    if (initial <= std::chrono::milliseconds(0))
+    {
+        initial = std::chrono::milliseconds(1);
+    }
+    const itimerspec spec{.it_interval = to_timespec(interval), .it_value = to_timespec(initial)};
+    if (timerfd_settime(fd.get(), 0, &spec, nullptr) != 0)
+    {
+        perror("timerfd_settime");
+        return false;
+    }
+    return true;
+}
+
+bool TimerFd::disarm()
+{
+    const itimerspec spec{};
+    if (timerfd_settime(fd.get(), 0, &spec, nullptr) != 0)
+    {
+        perror("timerfd_settime");
+        return false;
+    }
+    return true;
+}
+
+std::uint64_t TimerFd::consume()
+{
+    std::uint64_t expirations = 0;
+    if (read(fd.get(), &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return 0;
+    }
+    return expirations;
+}
+
+bool SignalFd::create(std::initializer_list<int> signals)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signal : signals)
+    {
+        sigaddset(&mask, signal);
+    }
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
+    {
+        perror("pthread_sigmask");
+        return false;
+    }
+
+    fd.reset(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+    if (!fd.valid())
+    {
+        perror("signalfd");
+        return false;
+    }
+    return true;
+}
+
+int SignalFd::consume()
+{
+    signalfd_siginfo info;
+    if (read(fd.get(), &info, sizeof(info)) != sizeof(info))
+    {
+        return 0;
+    }
+    return static_cast<int>(info.ssi_signo);
+}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "PosixIO.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <unordered_map>
+
+namespace clipboard
+{
+// epoll-based fd registry. Handlers receive the epoll event mask and may add
+// or remove registrations (including their own) while being dispatched.
+class EventLoop
+{
+public:
+    using Handler = std::function<void(std::uint32_t events)>;
+
+    EventLoop() = default;
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    bool initialize();
+    bool add(int fd, std::uint32_t events, Handler handler);
+    bool modify(int fd, std::uint32_t events);
+    void remove(int fd);
+    // Waits up to timeout_ms (-1 blocks) and dispatches ready handlers.
+    bool run_once(int timeout_ms = -1);
+
+private:
+    UniqueFd epoll_fd;
+    std::uint64_t next_token = 1;
+    std::unordered_map<int, std::uint64_t> tokens;
+    std::unordered_map<std::uint64_t, std::shared_ptr<Handler>> handlers;
+};
+
+class TimerFd
+{
+public:
+    bool create();
+    // A zero interval arms a one-shot timer.
+    bool arm(std::chrono::milliseconds initial, std::chrono::milliseconds interval = std::chrono::milliseconds(0));
+    bool disarm();
+    // Returns the number of expirations since the last call.
+    std::uint64_t consume();
+    int get() const { return fd.get(); }
+
+private:
+    UniqueFd fd;
+};
+
+class SignalFd
+{
+public:
+    // Blocks the signals for the calling thread and routes them to the fd.
+    bool create(std::initializer_list<int> signals);
+    // Returns the next pending signal number, or 0 when none is pending.
+    int consume();
+    int get() const { return fd.get(); }
+
+private:
+    UniqueFd fd;
+};
+}
@@ -0,0 +1,285 @@
+#include "FuzzyMatch.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLIPBOARD_FUZZY_X86 1
+#endif
+
+namespace clipboard
+{
+namespace
+{
+// The weights fzf uses.
+constexpr int score_match = 16;
+constexpr int gap_start = -3;
+constexpr int gap_extension = -1;
+constexpr int bonus_boundary = score_match / 2;
+constexpr int bonus_boundary_white = bonus_boundary + 2;
+constexpr int bonus_non_word = score_match / 2;
+constexpr int bonus_camel = bonus_boundary + gap_extension;
+constexpr int bonus_consecutive = -(gap_start + gap_extension);
+constexpr int first_char_multiplier = 2;
+constexpr int no_score = std::numeric_limits<int>::min() / 2;
+
+enum class CharClass
+{
+    white,
+    non_word,
+    lower,
+    upper,
+    digit,
+};
+
+CharClass classify(char c)
+{
+    if (c >= 'a' && c <= 'z')
+    {
+        return CharClass::lower;
+    }
+    if (c >= 'A' && c <= 'Z')
+    {
+        return CharClass::upper;
+    }
+    if (c >= '0' && c <= '9')
+    {
+        return CharClass::digit;
+    }
+    // Bytes of multibyte UTF-8 characters count as letters.
+    if (static_cast<unsigned char>(c) >= 0x80)
+    {
+        return CharClass::lower;
+    }
+    return c == ' ' || c == '\t' || c == '\n' ? CharClass::white : CharClass::non_word;
+}
+
+int bonus_for(CharClass previous, CharClass current)
+{
+    if (current == CharClass::white || current == CharClass::non_word)
+    {
+        return bonus_non_word;
+    }
+    if (previous == CharClass::white)
+    {
+        return bonus_boundary_white;
+    }
+    if (previous == CharClass::non_word)
+    {
+        return bonus_boundary;
+    }
+    if ((previous == CharClass::lower && current == CharClass::upper) ||
+        (previous != CharClass::digit && current == CharClass::digit))
+    {
+        return bonus_camel;
+    }
+    return 0;
+}
+
+char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Setting bit 5 lowercases ASCII letters and maps nothing else onto one, so
+// a lowercase letter is found in either case with a single compare.
+bool folds(char query, bool ignore_case)
+{
+    return ignore_case && query >= 'a' && query <= 'z';
+}
+
+std::size_t find_scalar(const char *text, std::size_t size, char query, bool fold)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        if ((fold ? static_cast<char>(text[i] | 0x20) : text[i]) == query)
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+#ifdef CLIPBOARD_FUZZY_X86
+__attribute__((target("sse4.1"))) std::size_t find_sse(const char *text, std::size_t size, char query, bool fold)
+{
+    const __m128i needle = _mm_set1_epi8(query);
+    const __m128i case_bit = _mm_set1_epi8(fold ? 0x20 : 0);
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i chunk = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i)), case_bit);
+        if (const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)))
+        {
+            return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+        }
+    }
+    return i + find_scalar(text + i, size - i, query, fold);
+}
+
+__attribute__((target("avx2"))) std::size_t find_avx2(const char *text, std::size_t size, char query, bool fold)
+{
+    const __m256i needle = _mm256_set1_epi8(query);
+    const __m256i case_bit = _mm256_set1_epi8(fold ? 0x20 : 0);
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        const __m256i chunk =
+            _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i)), case_bit);
+        if (const int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)))
+        {
+            return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+        }
+    }
+    // The 16-byte step is repeated here rather than calling find_sse, whose
+    // legacy SSE encoding would pay for switching out of AVX state.
+    if (i + 16 <= size)
+    {
+        const __m128i chunk = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i)),
+                                           _mm256_castsi256_si128(case_bit));
+        if (const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(needle))))
+        {
+            return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+        }
+        i += 16;
+    }
+    return i + find_scalar(text + i, size - i, query, fold);
+}
+#endif
+
+// Index of the first byte of text equal to query, or text.size().
+std::size_t find_char(std::string_view text, char query, bool fold, SimdLevel level)
+{
+#ifdef CLIPBOARD_FUZZY_X86
+    if (level >= SimdLevel::avx2)
+    {
+        return find_avx2(text.data(), text.size(), query, fold);
+    }
+    if (level >= SimdLevel::sse41)
+    {
+        return find_sse(text.data(), text.size(), query, fold);
+    }
+#else
+    (void)level;
+#endif
+    return find_scalar(text.data(), text.size(), query, fold);
+}
+}
+
+FuzzyQuery::FuzzyQuery(std::string_view query, SimdLevel level)
+    : pattern(query), ignore_case(std::ranges::none_of(query, [](char c)
+                                                       { return c >= 'A' && c <= 'Z'; })),
+      level(level)
+{
+}
+
+bool FuzzyQuery::same(char text, char query) const
+{
+    return (ignore_case ? lower(text) : text) == query;
+}
+
+std::optional<std::size_t> FuzzyQuery::match_start(std::string_view text) const
+{
+    std::size_t position = 0;
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < pattern.size(); ++i)
+    {
+        const auto found = find_char(text.substr(position), pattern[i], folds(pattern[i], ignore_case), level);
+        if (position + found >= text.size())
+        {
+            return std::nullopt;
+        }
+        if (i == 0)
+        {
+            start = position + found;
+        }
+        position += found + 1;
+    }
+    return start;
+}
+
+std::optional<int> FuzzyQuery::score(std::string_view text) const
+{
+    if (pattern.empty())
+    {
+        return 0;
+    }
+    const auto start = match_start(text);
+    if (!start)
+    {
+        return std::nullopt;
+    }
+    text.remove_prefix(*start);
+    const auto previous_class = *start > 0 ? classify(text.data()[-1]) : CharClass::white;
+
+    bonus.resize(text.size());
+    auto previous = previous_class;
+    for (std::size_t j = 0; j < text.size(); ++j)
+    {
+        const auto current = classify(text[j]);
+        bonus[j] = bonus_for(previous, current);
+        previous = current;
+    }
+
+    // row[j]: best score with the current query character matched at j.
+    // run[j]: the bonus that started the consecutive run ending at j, which
+    // every character of the run keeps, as in fzf.
+    row.assign(text.size(), no_score);
+    run.assign(text.size(), 0);
+    for (std::size_t j = 0; j < text.size(); ++j)
+    {
+        if (same(text[j], pattern[0]))
+        {
+            row[j] = score_match + bonus[j] * first_char_multiplier;
+            run[j] = bonus[j];
+        }
+    }
+
+    next.resize(text.size());
+    next_run.resize(text.size());
+    for (std::size_t i = 1; i < pattern.size(); ++i)
+    {
+        // Best score of an earlier match followed by a gap up to j.
+        int gapped = no_score;
+        std::ranges::fill(next, no_score);
+        std::ranges::fill(next_run, 0);
+        for (std::size_t j = 1; j < text.size(); ++j)
+        {
+            if (j >= 2 && row[j - 2] > no_score)
+            {
+                gapped = std::max(gapped == no_score ? no_score : gapped + gap_extension, row[j - 2] + gap_start);
+            }
+            else if (gapped != no_score)
+            {
+                gapped += gap_extension;
+            }
+            if (!same(text[j], pattern[i]))
+            {
+                continue;
+            }
+            if (row[j - 1] > no_score)
+            {
+                const int carried = std::max({bonus[j], run[j - 1], bonus_consecutive});
+                next[j] = row[j - 1] + score_match + carried;
+                next_run[j] = std::max(run[j - 1], bonus[j]);
+            }
+            if (gapped > no_score && gapped + score_match + bonus[j] > next[j])
+            {
+                next[j] = gapped + score_match + bonus[j];
+                next_run[j] = bonus[j];
+            }
+        }
+        std::swap(row, next);
+        std::swap(run, next_run);
+    }
+
+    const int best = std::ranges::max(row);
+    if (best <= no_score)
+    {
+        return std::nullopt;
+    }
+    return best;
+}
+}
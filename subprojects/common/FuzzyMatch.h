@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Simd.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clipboard
+{
+// fzf-style fuzzy matching. Text matches when it contains the query's
+// characters in order. The score rewards matches at word starts and runs of
+// consecutive characters and charges for the gaps between them, taking the
+// best alignment. A query without uppercase letters ignores ASCII case.
+// score() reuses scratch buffers, so a query must not be shared between
+// threads.
+class FuzzyQuery
+{
+public:
+    explicit FuzzyQuery(std::string_view query, SimdLevel level = best_simd_level());
+
+    // std::nullopt when text does not match.
+    std::optional<int> score(std::string_view text) const;
+
+private:
+    std::string pattern;
+    bool ignore_case = true;
+    SimdLevel level;
+    mutable std::vector<int> bonus;
+    mutable std::vector<int> row;
+    mutable std::vector<int> run;
+    mutable std::vector<int> next;
+    mutable std::vector<int> next_run;
+
+    bool same(char text, char query) const;
+    // Position of the leftmost complete match's first character, found with
+    // vector compares; rejects most texts before any scoring.
+    std::optional<std::size_t> match_start(std::string_view text) const;
+};
+}
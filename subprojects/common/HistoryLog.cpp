@@ -0,0 +1,990 @@
+#include "HistoryLog.h"
+#include "BlobStore.h"
+#include "TextSearch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clipboard
+{
+namespace
+{
+constexpr char log_magic[4] = {'W', 'L', 'C', 'H'};
+constexpr std::uint32_t log_version = 7;
+// Version 2 logs did not record evictions; replay kept the newest entries.
+constexpr std::uint32_t implicit_trim_version = 2;
+// Push records gained the entry summary in version 4.
+constexpr std::uint32_t summary_version = 4;
+// Compressed payload records appeared in version 5; older logs are
+// compressed when they are rewritten.
+constexpr std::uint32_t compressed_version = 5;
+// Summaries gained the trigram filter in version 6.
+constexpr std::uint32_t trigram_version = 6;
+// Summaries gained entry flags in version 7.
+constexpr std::uint32_t flags_version = 7;
+constexpr std::uint32_t partial_flag = 1;
+constexpr std::size_t implicit_trim_entries = 25;
+constexpr std::size_t log_header_size = sizeof(log_magic) + sizeof(std::uint32_t);
+constexpr std::size_t record_header_size = sizeof(std::uint32_t) + sizeof(std::uint64_t);
+// Hash, codec and uncompressed size ahead of the compressed bytes.
+constexpr std::size_t compressed_prefix_size = 2 * sizeof(std::uint64_t) + sizeof(std::uint32_t);
+constexpr std::uint64_t min_compaction_waste = 1024 * 1024;
+
+template <typename T>
+void put(std::string &out, T value)
+{
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+std::string make_record(LogRecordType type, const std::string &body)
+{
+    std::string record;
+    record.reserve(record_header_size + body.size());
+    put<std::uint32_t>(record, static_cast<std::uint32_t>(type));
+    put<std::uint64_t>(record, body.size());
+    record += body;
+    return record;
+}
+
+class Reader
+{
+public:
+    explicit Reader(std::string_view data) : data(data) {}
+
+    template <typename T>
+    bool get(T &value)
+    {
+        if (data.size() - offset < sizeof(T))
+        {
+            return false;
+        }
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    bool get_bytes(std::string_view &value, std::uint64_t length)
+    {
+        if (data.size() - offset < length)
+        {
+            return false;
+        }
+        value = data.substr(offset, length);
+        offset += length;
+        return true;
+    }
+
+    std::size_t position() const { return offset; }
+
+private:
+    std::string_view data;
+    std::size_t offset = 0;
+};
+}
+
+std::string encode_log_header()
+{
+    std::string header(log_magic, sizeof(log_magic));
+    put<std::uint32_t>(header, log_version);
+    return header;
+}
+
+std::uint64_t payload_record_size(const Payload &payload)
+{
+    if (payload.is_blob())
+    {
+        return record_header_size + 2 * sizeof(std::uint64_t);
+    }
+    if (payload.is_compressed())
+    {
+        return record_header_size + compressed_prefix_size + payload.compressed_data().size();
+    }
+    return record_header_size + sizeof(std::uint64_t) + payload.size();
+}
+
+std::uint64_t push_record_size(const EntryDigest &digest)
+{
+    std::uint64_t size = record_header_size + sizeof(std::uint32_t);
+    for (const auto &[mime, hash] : digest.payloads)
+    {
+        size += sizeof(std::uint32_t) + mime_name(mime).size() + sizeof(hash);
+    }
+    return size + sizeof(std::int64_t) + 3 * sizeof(std::uint32_t) + digest.summary.preview.size() +
+           digest.summary.trigrams.size();
+}
+
+std::string encode_payload_record(std::uint64_t hash, const Payload &payload)
+{
+    std::string record;
+    record.reserve(payload_record_size(payload));
+    if (payload.is_blob())
+    {
+        put<std::uint32_t>(record, static_cast<std::uint32_t>(LogRecordType::blob_payload));
+        put<std::uint64_t>(record, 2 * sizeof(std::uint64_t));
+        put<std::uint64_t>(record, hash);
+        put<std::uint64_t>(record, payload.size());
+        return record;
+    }
+    if (payload.is_compressed())
+    {
+        put<std::uint32_t>(record, static_cast<std::uint32_t>(LogRecordType::compressed_payload));
+        put<std::uint64_t>(record, compressed_prefix_size + payload.compressed_data().size());
+        put<std::uint64_t>(record, hash);
+        put<std::uint32_t>(record, static_cast<std::uint32_t>(payload.codec()));
+        put<std::uint64_t>(record, payload.size());
+        record += payload.compressed_data();
+        return record;
+    }
+    put<std::uint32_t>(record, static_cast<std::uint32_t>(LogRecordType::payload));
+    put<std::uint64_t>(record, sizeof(hash) + payload.size());
+    put<std::uint64_t>(record, hash);
+    record += payload.data();
+    return record;
+}
+
+std::string encode_push_record(const EntryDigest &digest)
+{
+    std::string body;
+    body.reserve(push_record_size(digest) - record_header_size);
+    put<std::uint32_t>(body, static_cast<std::uint32_t>(digest.payloads.size()));
+    for (const auto &[mime, hash] : digest.payloads)
+    {
+        const auto &name = mime_name(mime);
+        put<std::uint32_t>(body, static_cast<std::uint32_t>(name.size()));
+        body += name;
+        put<std::uint64_t>(body, hash);
+    }
+    put<std::int64_t>(body, digest.summary.captured_at);
+    put<std::uint32_t>(body, static_cast<std::uint32_t>(digest.summary.preview.size()));
+    body += digest.summary.preview;
+    put<std::uint32_t>(body, static_cast<std::uint32_t>(digest.summary.trigrams.size()));
+    body += digest.summary.trigrams;
+    put<std::uint32_t>(body, digest.summary.partial ? partial_flag : 0);
+    return make_record(LogRecordType::push_entry, body);
+}
+
+std::string encode_erase_record(std::size_t index)
+{
+    std::string body;
+    put<std::uint64_t>(body, index);
+    return make_record(LogRecordType::erase_entry, body);
+}
+
+std::string encode_promote_record(std::size_t index)
+{
+    std::string body;
+    put<std::uint64_t>(body, index);
+    return make_record(LogRecordType::promote_entry, body);
+}
+
+void compress_entry(ClipboardEntry &entry, const EntryDigest &digest)
+{
+    std::vector<std::pair<std::uint64_t, std::optional<Payload>>> done;
+    for (const auto &[mime, hash] : digest.payloads)
+    {
+        const auto &payload = entry.at(mime);
+        if (payload.is_blob() || payload.is_compressed())
+        {
+            continue;
+        }
+        if (const auto it = std::ranges::find(done, hash, &decltype(done)::value_type::first); it != done.end())
+        {
+            if (it->second)
+            {
+                entry.insert_or_assign(mime, *it->second);
+            }
+            continue;
+        }
+        const auto codec = codec_for_mime(mime_name(mime));
+        auto data = compress_payload(codec, payload.data());
+        if (!data)
+        {
+            done.emplace_back(hash, std::nullopt);
+            continue;
+        }
+        auto compressed = Payload::compressed(std::move(*data), codec, payload.size(), hash);
+        entry.insert_or_assign(mime, compressed);
+        done.emplace_back(hash, std::move(compressed));
+    }
+}
+
+bool decode_push_record(std::string_view body, const LogIndex &index, std::vector<LogPayload> &payloads,
+                        EntrySummary *summary, std::string_view *trigrams)
+{
+    payloads.clear();
+    Reader reader(body);
+    std::uint32_t mime_count = 0;
+    if (!reader.get(mime_count))
+    {
+        return false;
+    }
+    for (std::uint32_t i = 0; i < mime_count; ++i)
+    {
+        std::uint32_t mime_size = 0;
+        std::uint64_t hash = 0;
+        std::string_view mime;
+        if (!reader.get(mime_size) || !reader.get_bytes(mime, mime_size) || !reader.get(hash))
+        {
+            return false;
+        }
+        LogPayload payload;
+        payload.mime = mime;
+        payload.hash = hash;
+        if (const auto data = index.payloads.find(hash); data != index.payloads.end())
+        {
+            payload.data = data->second;
+        }
+        else if (const auto blob = index.blobs.find(hash); blob != index.blobs.end())
+        {
+            payload.blob = true;
+            payload.blob_size = blob->second;
+        }
+        else if (const auto compressed = index.compressed.find(hash); compressed != index.compressed.end())
+        {
+            payload.data = compressed->second.data;
+            payload.codec = compressed->second.codec;
+            payload.size = compressed->second.size;
+        }
+        else
+        {
+            return false;
+        }
+        payloads.push_back(payload);
+    }
+    if (index.summaries)
+    {
+        std::int64_t captured_at = 0;
+        std::uint32_t preview_size = 0;
+        std::string_view preview;
+        if (!reader.get(captured_at) || !reader.get(preview_size) || !reader.get_bytes(preview, preview_size))
+        {
+            return false;
+        }
+        if (summary)
+        {
+            summary->captured_at = captured_at;
+            summary->preview = preview;
+        }
+    }
+    if (index.trigram_filters)
+    {
+        std::uint32_t filter_size = 0;
+        std::string_view filter;
+        if (!reader.get(filter_size) || !reader.get_bytes(filter, filter_size))
+        {
+            return false;
+        }
+        if (trigrams)
+        {
+            *trigrams = filter;
+        }
+        else if (summary)
+        {
+            summary->trigrams = filter;
+        }
+    }
+    if (index.entry_flags)
+    {
+        std::uint32_t flags = 0;
+        if (!reader.get(flags))
+        {
+            return false;
+        }
+        if (summary)
+        {
+            summary->partial = flags & partial_flag;
+        }
+    }
+    return reader.position() == body.size();
+}
+
+LogIndex index_history_log(std::string_view log)
+{
+    LogIndex index;
+    if (log.size() < log_header_size || log.substr(0, sizeof(log_magic)) != std::string_view(log_magic, sizeof(log_magic)))
+    {
+        throw std::runtime_error("not a clipboard history log");
+    }
+    std::memcpy(&index.version, log.data() + sizeof(log_magic), sizeof(index.version));
+    if (index.version < implicit_trim_version || index.version > log_version)
+    {
+        throw std::runtime_error("unsupported clipboard history log version");
+    }
+    index.summaries = index.version >= summary_version;
+    index.trigram_filters = index.version >= trigram_version;
+    index.entry_flags = index.version >= flags_version;
+
+    Reader reader(log.substr(log_header_size));
+    index.valid_size = log_header_size;
+    std::vector<LogPayload> scratch;
+    // Entries are collected oldest first, so a push is an append and
+    // positions count from the back; the oldest `trimmed` of them fell
+    // past the implicit limit.
+    auto &entries = index.entries;
+    std::size_t trimmed = 0;
+
+    while (true)
+    {
+        std::uint32_t type = 0;
+        std::uint64_t size = 0;
+        std::string_view body;
+        if (!reader.get(type) || !reader.get(size) || !reader.get_bytes(body, size))
+        {
+            index.torn_tail = true;
+            break;
+        }
+
+        if (type == static_cast<std::uint32_t>(LogRecordType::payload))
+        {
+            std::uint64_t hash = 0;
+            if (size < sizeof(hash))
+            {
+                break;
+            }
+            std::memcpy(&hash, body.data(), sizeof(hash));
+            index.payloads[hash] = body.substr(sizeof(hash));
+        }
+        else if (type == static_cast<std::uint32_t>(LogRecordType::blob_payload))
+        {
+            std::uint64_t blob[2] = {0, 0};
+            if (size != sizeof(blob))
+            {
+                break;
+            }
+            std::memcpy(blob, body.data(), sizeof(blob));
+            index.blobs[blob[0]] = blob[1];
+        }
+        else if (type == static_cast<std::uint32_t>(LogRecordType::compressed_payload))
+        {
+            std::uint64_t hash = 0;
+            std::uint32_t codec = 0;
+            CompressedRecord record;
+            if (size < compressed_prefix_size)
+            {
+                break;
+            }
+            std::memcpy(&hash, body.data(), sizeof(hash));
+            std::memcpy(&codec, body.data() + sizeof(hash), sizeof(codec));
+            std::memcpy(&record.size, body.data() + sizeof(hash) + sizeof(codec), sizeof(record.size));
+            record.codec = static_cast<Codec>(codec);
+            if (record.codec != Codec::lz4 && record.codec != Codec::zstd)
+            {
+                break;
+            }
+            record.data = body.substr(compressed_prefix_size);
+            index.compressed[hash] = record;
+        }
+        else if (type == static_cast<std::uint32_t>(LogRecordType::push_entry))
+        {
+            if (!decode_push_record(body, index, scratch))
+            {
+                break;
+            }
+            entries.push_back(body);
+            if (index.version == implicit_trim_version && entries.size() - trimmed > implicit_trim_entries)
+            {
+                ++trimmed;
+            }
+        }
+        else if (type == static_cast<std::uint32_t>(LogRecordType::erase_entry) ||
+                 type == static_cast<std::uint32_t>(LogRecordType::promote_entry))
+        {
+            std::uint64_t position = 0;
+            if (size != sizeof(position))
+            {
+                break;
+            }
+            std::memcpy(&position, body.data(), sizeof(position));
+            if (position < entries.size() - trimmed)
+            {
+                const auto it = entries.end() - 1 - static_cast<std::ptrdiff_t>(position);
+                if (type == static_cast<std::uint32_t>(LogRecordType::erase_entry))
+                {
+                    entries.erase(it);
+                }
+                else
+                {
+                    std::rotate(it, it + 1, entries.end());
+                }
+            }
+        }
+        else
+        {
+            break;
+        }
+
+        index.valid_size = log_header_size + reader.position();
+    }
+
+    entries.erase(entries.begin(), entries.begin() + static_cast<std::ptrdiff_t>(trimmed));
+    std::ranges::reverse(entries);
+    return index;
+}
+
+std::optional<LogReplay> replay_history_log(const std::filesystem::path &path)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path))
+    {
+        if (errno == ENOENT)
+        {
+            return std::nullopt;
+        }
+        throw std::runtime_error(std::strerror(errno));
+    }
+
+    const auto index = index_history_log(file->data());
+    LogReplay replay;
+    replay.version = index.version;
+    replay.valid_size = index.valid_size;
+    replay.torn_tail = index.torn_tail;
+    replay.file_size = file->data().size();
+    replay.history.reserve(index.entries.size());
+    replay.digests.reserve(index.entries.size());
+
+    const auto blobs = blob_directory(path);
+    std::vector<LogPayload> payloads;
+    for (const auto body : index.entries)
+    {
+        EntrySummary summary;
+        decode_push_record(body, index, payloads, &summary);
+        ClipboardEntry entry;
+        entry.reserve(payloads.size());
+        std::vector<std::pair<MimeId, std::uint64_t>> payload_hashes;
+        payload_hashes.reserve(payloads.size());
+        for (const auto &payload : payloads)
+        {
+            const auto mime = intern_mime(payload.mime);
+            if (payload.blob)
+            {
+                entry.insert_or_assign(mime, Payload::blob(blob_path(blobs, payload.hash), payload.hash, payload.blob_size));
+            }
+            else if (payload.codec != Codec::none)
+            {
+                entry.insert_or_assign(mime, Payload::compressed(file, payload.data, payload.codec, payload.size, payload.hash));
+            }
+            else
+            {
+                // Appends and truncation of a torn tail leave the mapped
+                // records in place, and compaction replaces the file by
+                // rename, so the mapping stays valid.
+                entry.insert_or_assign(mime, Payload::mapped(file, payload.data, payload.hash));
+            }
+            payload_hashes.emplace_back(mime, payload.hash);
+        }
+        if (!index.summaries)
+        {
+            summary = summarize_entry(entry);
+            summary.captured_at = 0;
+        }
+        else if (!index.trigram_filters)
+        {
+            if (const auto text = entry.find(text_plain_mime); text != entry.end())
+            {
+                summary.trigrams = trigram_filter(text->second.is_blob() ? text->second.load() : text->second.data());
+            }
+        }
+        replay.history.push_back(std::move(entry));
+        replay.digests.push_back(make_entry_digest(std::move(payload_hashes)));
+        replay.digests.back().summary = std::move(summary);
+    }
+
+    return replay;
+}
+
+std::string encode_history_log(const ClipboardHistory &history, const std::vector<EntryDigest> &digests)
+{
+    // Entries are replayed as pushes to the front, so write the oldest first.
+    std::string log_data = encode_log_header();
+    std::unordered_set<std::uint64_t> written;
+    for (std::size_t i = digests.size(); i-- > 0;)
+    {
+        for (const auto &[mime, hash] : digests[i].payloads)
+        {
+            if (written.insert(hash).second)
+            {
+                log_data += encode_payload_record(hash, history[i].at(mime));
+            }
+        }
+        log_data += encode_push_record(digests[i]);
+    }
+    return log_data;
+}
+
+bool replace_history_log(const std::filesystem::path &path, std::string_view log_data)
+{
+    try
+    {
+        std::filesystem::create_directories(path.parent_path());
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Failed to create clipboard history directory: " << e.what() << std::endl;
+        return false;
+    }
+
+    auto tmp_template = path;
+    tmp_template += ".tmp.XXXXXX";
+    std::string tmp_name = tmp_template.string();
+    UniqueFd fd(mkstemp(tmp_name.data()));
+    if (!fd.valid())
+    {
+        perror("mkstemp");
+        return false;
+    }
+
+    bool ok = true;
+    chmod(tmp_name.c_str(), S_IRUSR | S_IWUSR);
+    ok = write_all(fd.get(), log_data) && fsync(fd.get()) == 0;
+
+    if (!ok)
+    {
+        perror("write clipboard history");
+    }
+
+    if (fd.valid() && close(fd.release()) != 0)
+    {
+        perror("close clipboard history");
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        std::filesystem::remove(tmp_name);
+        std::cerr << "Failed to write clipboard history temp file: " << tmp_name << std::endl;
+        return false;
+    }
+
+    try
+    {
+        std::filesystem::rename(tmp_name, path);
+        chmod(path.c_str(), S_IRUSR | S_IWUSR);
+        UniqueFd dir_fd(open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY));
+        if (dir_fd.valid())
+        {
+            fsync(dir_fd.get());
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::filesystem::remove(tmp_name);
+        std::cerr << "Failed to replace clipboard history: " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool write_history_log(const std::filesystem::path &path, const ClipboardHistory &history,
+                       const std::vector<EntryDigest> &digests)
+{
+    return replace_history_log(path, encode_history_log(history, digests));
+}
+
+ClipboardHistory HistoryLog::open()
+{
+    if (path.empty())
+    {
+        std::cerr << "Cannot open clipboard history: XDG_DATA_HOME and HOME are unset" << std::endl;
+        return {};
+    }
+
+    std::optional<LogReplay> replay;
+    try
+    {
+        replay = replay_history_log(path);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Replacing invalid clipboard history at " << path << ": " << e.what() << std::endl;
+        preserve_damaged_log();
+        replay = LogReplay{};
+    }
+
+    if (!replay)
+    {
+        // First run with the log format: import the legacy JSON history once.
+        // It only ever held the clipboard's history.
+        replay.emplace();
+        if (path == history_path())
+        {
+            replay->history = load_history();
+        }
+    }
+
+    auto history = std::move(replay->history);
+    if (replay->digests.size() == history.size())
+    {
+        digests = std::move(replay->digests);
+    }
+    else
+    {
+        digests.clear();
+        for (const auto &entry : history)
+        {
+            digests.push_back(digest_entry(entry));
+        }
+    }
+    if (replay->version < compressed_version)
+    {
+        for (std::size_t i = 0; i < history.size(); ++i)
+        {
+            compress_entry(history[i], digests[i]);
+        }
+    }
+    reset_layout(history);
+    // The limits may have shrunk since the log was written.
+    const bool trimmed = !trim(history).empty();
+
+    // Damage in the middle of the log is not an interrupted append: the log
+    // is copied aside before it is rewritten, and its blobs are left until
+    // the log is next opened, in case the records past the damage can be
+    // recovered by hand.
+    const bool damaged = replay->valid_size < replay->file_size && !replay->torn_tail;
+    if (damaged)
+    {
+        std::cerr << "Malformed record in " << path << ", keeping the entries before it" << std::endl;
+        preserve_damaged_log();
+    }
+    else
+    {
+        remove_dead_blobs();
+    }
+
+    if (damaged || replay->valid_size == 0 || trimmed || replay->version != log_version)
+    {
+        compact(history);
+        return history;
+    }
+
+    if (replay->valid_size < replay->file_size)
+    {
+        std::cerr << "Discarding truncated record at the end of " << path << std::endl;
+        if (truncate(path.c_str(), static_cast<off_t>(replay->valid_size)) != 0)
+        {
+            perror("truncate clipboard history");
+            compact(history);
+            return history;
+        }
+    }
+
+    file_size = replay->valid_size;
+    needs_rewrite = !open_for_append();
+    return history;
+}
+
+bool HistoryLog::push_front(ClipboardHistory &history, ClipboardEntry entry)
+{
+    auto entry_digest = digest_entry(entry);
+    return push_front(history, std::move(entry), std::move(entry_digest));
+}
+
+bool HistoryLog::push_front(ClipboardHistory &history, ClipboardEntry entry, EntryDigest digest)
+{
+    // Compressed before encoding, which also keeps the history in memory
+    // small; a payload already in the log compresses to the same record.
+    compress_entry(entry, digest);
+    std::string records;
+    for (const auto &[mime, hash] : digest.payloads)
+    {
+        if (!payloads.contains(hash))
+        {
+            const auto &payload = entry.at(mime);
+            records += encode_payload_record(hash, payload);
+            track_payload(hash, payload);
+        }
+    }
+    records += encode_push_record(digest);
+
+    add_entry_refs(digest);
+    history.insert(history.begin(), std::move(entry));
+    digests.insert(digests.begin(), std::move(digest));
+    records += trim(history);
+    remove_released_blobs();
+
+    if (must_rewrite() || should_compact())
+    {
+        return compact(history);
+    }
+    if (!append_records(std::move(records)))
+    {
+        needs_rewrite = true;
+        return false;
+    }
+    return true;
+}
+
+bool HistoryLog::erase(ClipboardHistory &history, std::size_t index)
+{
+    if (index >= history.size())
+    {
+        return false;
+    }
+    release_entry_refs(digests[index]);
+    history.erase(history.begin() + static_cast<std::ptrdiff_t>(index));
+    digests.erase(digests.begin() + static_cast<std::ptrdiff_t>(index));
+
+    if (must_rewrite())
+    {
+        return compact(history);
+    }
+    if (!append_records(encode_erase_record(index)))
+    {
+        needs_rewrite = true;
+        return false;
+    }
+    return true;
+}
+
+bool HistoryLog::promote(ClipboardHistory &history, std::size_t index)
+{
+    if (index >= history.size())
+    {
+        return false;
+    }
+    const auto offset = static_cast<std::ptrdiff_t>(index);
+    std::rotate(history.begin(), history.begin() + offset, history.begin() + offset + 1);
+    std::rotate(digests.begin(), digests.begin() + offset, digests.begin() + offset + 1);
+
+    if (must_rewrite())
+    {
+        return compact(history);
+    }
+    if (!append_records(encode_promote_record(index)))
+    {
+        needs_rewrite = true;
+        return false;
+    }
+    return true;
+}
+
+std::optional<std::size_t> HistoryLog::find(const EntryDigest &digest) const
+{
+    if (!entry_hashes.contains(digest.hash))
+    {
+        return std::nullopt;
+    }
+    const auto it = std::ranges::find(digests, digest.hash, &EntryDigest::hash);
+    if (it == digests.end())
+    {
+        return std::nullopt;
+    }
+    return static_cast<std::size_t>(it - digests.begin());
+}
+
+void HistoryLog::write_in_background(std::chrono::milliseconds window)
+{
+    fd.reset();
+    writer = std::make_unique<LogWriter>(path, window);
+}
+
+bool HistoryLog::flush()
+{
+    return !writer || writer->flush();
+}
+
+bool HistoryLog::compact(const ClipboardHistory &history)
+{
+    fd.reset();
+    if (writer)
+    {
+        // Blobs dead in memory are removed before the replacement reaches
+        // the disk; a crash in between leaves the old log pointing at them,
+        // which readers skip.
+        writer->replace(encode_history_log(history, digests));
+    }
+    else if (!write_history_log(path, history, digests))
+    {
+        needs_rewrite = true;
+        return false;
+    }
+
+    reset_layout(history);
+    file_size = live_size + encode_log_header().size();
+    remove_dead_blobs();
+    needs_rewrite = !writer && !open_for_append();
+    return !needs_rewrite;
+}
+
+void HistoryLog::preserve_damaged_log() const
+{
+    auto copy = path;
+    copy += ".damaged";
+    std::error_code error;
+    std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing, error);
+    if (error)
+    {
+        std::cerr << "Failed to keep a copy of the damaged clipboard history: " << error.message() << std::endl;
+        return;
+    }
+    std::cerr << "Kept a copy of the damaged clipboard history at " << copy << std::endl;
+}
+
+void HistoryLog::reset_layout(const ClipboardHistory &history)
+{
+    entry_hashes.clear();
+    payloads.clear();
+    released_blobs.clear();
+    live_size = 0;
+    live_bytes = 0;
+    for (std::size_t i = 0; i < digests.size(); ++i)
+    {
+        for (const auto &[mime, hash] : digests[i].payloads)
+        {
+            track_payload(hash, history[i].at(mime));
+        }
+        add_entry_refs(digests[i]);
+    }
+}
+
+void HistoryLog::track_payload(std::uint64_t hash, const Payload &payload)
+{
+    auto &stored = payloads[hash];
+    stored.record_size = payload_record_size(payload);
+    stored.bytes = payload.size();
+    stored.blob = payload.is_blob();
+}
+
+void HistoryLog::remove_dead_blobs() const
+{
+    std::unordered_set<std::uint64_t> live;
+    for (const auto &[hash, payload] : payloads)
+    {
+        if (payload.blob && payload.refs > 0)
+        {
+            live.insert(hash);
+        }
+    }
+    remove_unreferenced_blobs(blobs, live);
+}
+
+void HistoryLog::remove_released_blobs()
+{
+    for (const auto hash : released_blobs)
+    {
+        const auto payload = payloads.find(hash);
+        if (payload == payloads.end() || payload->second.refs > 0)
+        {
+            continue;
+        }
+        std::error_code ec;
+        std::filesystem::remove(blob_path(blobs, hash), ec);
+        // Without its file the record is of no use to a later push of the
+        // same content, which has to store the blob again.
+        payloads.erase(payload);
+    }
+    released_blobs.clear();
+}
+
+void HistoryLog::add_entry_refs(const EntryDigest &digest)
+{
+    ++entry_hashes[digest.hash];
+    live_size += push_record_size(digest);
+    for (const auto &[mime, hash] : digest.payloads)
+    {
+        auto &payload = payloads[hash];
+        if (payload.refs++ == 0)
+        {
+            live_size += payload.record_size;
+            live_bytes += payload.bytes;
+        }
+    }
+}
+
+void HistoryLog::release_entry_refs(const EntryDigest &digest)
+{
+    if (auto it = entry_hashes.find(digest.hash); it != entry_hashes.end() && --it->second == 0)
+    {
+        entry_hashes.erase(it);
+    }
+    live_size -= push_record_size(digest);
+    for (const auto &[mime, hash] : digest.payloads)
+    {
+        // Dead payload records stay known until compaction so re-adding the
+        // same content does not append it again.
+        auto &payload = payloads[hash];
+        if (--payload.refs == 0)
+        {
+            live_size -= payload.record_size;
+            live_bytes -= payload.bytes;
+            if (payload.blob)
+            {
+                released_blobs.push_back(hash);
+            }
+        }
+    }
+}
+
+std::string HistoryLog::trim(ClipboardHistory &history)
+{
+    // Copies and restores move entries to the front, so the back is the
+    // least recently used.
+    std::string records;
+    while (history.size() > 1 && (history.size() > limits.max_entries || live_bytes > limits.max_bytes))
+    {
+        release_entry_refs(digests.back());
+        history.pop_back();
+        digests.pop_back();
+        records += encode_erase_record(history.size());
+    }
+    return records;
+}
+
+bool HistoryLog::append_records(std::string records)
+{
+    if (writer)
+    {
+        if (writer->failed())
+        {
+            return false;
+        }
+        file_size += records.size();
+        writer->append(std::move(records));
+        return true;
+    }
+    if (!fd.valid())
+    {
+        return false;
+    }
+    if (!write_all(fd.get(), records) || fdatasync(fd.get()) != 0)
+    {
+        perror("append clipboard history");
+        fd.reset();
+        return false;
+    }
+    file_size += records.size();
+    return true;
+}
+
+bool HistoryLog::open_for_append()
+{
+    fd.reset(::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC));
+    if (!fd.valid())
+    {
+        perror("open clipboard history");
+        return false;
+    }
+    return true;
+}
+
+bool HistoryLog::must_rewrite() const
+{
+    return needs_rewrite || (writer && writer->failed());
+}
+
+bool HistoryLog::should_compact() const
+{
+    const auto waste = file_size > live_size ? file_size - live_size : 0;
+    return waste > std::max(live_size, min_compaction_waste);
+}
+}
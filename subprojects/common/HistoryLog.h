@@ -0,0 +1,206 @@
+#pragma once
+
+#include "ClipboardHistory.h"
+#include "LogWriter.h"
+#include "PosixIO.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace clipboard
+{
+// The history log is a header followed by length-prefixed records. Replaying
+// the records in order rebuilds the history; saving a new entry only appends
+// its records, and the file is rewritten from memory once enough dead records
+// have accumulated. Evicted entries get explicit erase records, so readers do
+// not need to know the writer's history limits. Payloads are stored once per
+// content hash and entries refer to them by hash. Large payloads live in blob
+// files next to the log and only their hash and size are recorded. Push
+// records also carry the entry's summary, so listing the history never touches
+// payload bytes. Inline payloads may be compressed with the codec their MIME
+// type calls for; they are decoded when something reads them.
+enum class LogRecordType : std::uint32_t
+{
+    push_entry = 1,
+    erase_entry = 2,
+    payload = 3,
+    promote_entry = 4,
+    blob_payload = 5,
+    compressed_payload = 6,
+};
+
+using PayloadViews = std::vector<std::pair<MimeId, Payload>>;
+
+// A payload referenced by a push record: inline bytes in the log image, or
+// a blob file of blob_size bytes named after hash. Compressed inline bytes
+// have a codec other than none and decode to size bytes.
+struct LogPayload
+{
+    std::string_view mime;
+    std::uint64_t hash = 0;
+    std::string_view data;
+    bool blob = false;
+    std::uint64_t blob_size = 0;
+    Codec codec = Codec::none;
+    std::uint64_t size = 0;
+};
+
+struct CompressedRecord
+{
+    Codec codec = Codec::none;
+    std::uint64_t size = 0;
+    std::string_view data;
+};
+
+// Live push record bodies of a log image, newest first, after applying
+// erase/promote records, plus every payload record.
+struct LogIndex
+{
+    std::uint32_t version = 0;
+    // Whether push records carry entry summaries, and whether those include
+    // trigram filters and entry flags.
+    bool summaries = false;
+    bool trigram_filters = false;
+    bool entry_flags = false;
+    std::vector<std::string_view> entries;
+    std::unordered_map<std::uint64_t, std::string_view> payloads;
+    std::unordered_map<std::uint64_t, std::uint64_t> blobs;
+    std::unordered_map<std::uint64_t, CompressedRecord> compressed;
+    std::uint64_t valid_size = 0;
+    // Reading stopped at a record that runs past the end of the log, as an
+    // interrupted append leaves one, rather than at a malformed record.
+    bool torn_tail = false;
+};
+
+struct LogReplay
+{
+    std::uint32_t version = 0;
+    ClipboardHistory history;
+    std::vector<EntryDigest> digests;
+    std::uint64_t valid_size = 0;
+    std::uint64_t file_size = 0;
+    bool torn_tail = false;
+};
+
+std::string encode_log_header();
+// Writes compressed payloads as they are stored; compress_entry decides
+// which payloads are stored compressed.
+std::string encode_payload_record(std::uint64_t hash, const Payload &payload);
+std::string encode_push_record(const EntryDigest &digest);
+std::string encode_erase_record(std::size_t index);
+std::string encode_promote_record(std::size_t index);
+std::uint64_t payload_record_size(const Payload &payload);
+std::uint64_t push_record_size(const EntryDigest &digest);
+
+// Replaces the entry's inline payloads with compressed ones where their MIME
+// type's codec saves enough. Payloads sharing a hash are compressed once.
+void compress_entry(ClipboardEntry &entry, const EntryDigest &digest);
+
+// Resolves a push record body against the payload records seen so far.
+// Records from logs older than the summary format leave summary empty, and
+// those older than trigram filters leave summary->trigrams empty. Given
+// trigrams, the filter is pointed at in body instead of copied to summary.
+bool decode_push_record(std::string_view body, const LogIndex &index, std::vector<LogPayload> &payloads,
+                        EntrySummary *summary = nullptr, std::string_view *trigrams = nullptr);
+
+// Throws std::runtime_error when log does not start with a history log header.
+// Replay stops at the first truncated or malformed record.
+LogIndex index_history_log(std::string_view log);
+
+// Returns std::nullopt when the log does not exist. Throws std::runtime_error
+// when the file is not a history log. A truncated or malformed record is not
+// an error: replay stops there and valid_size marks the end of the last
+// record.
+std::optional<LogReplay> replay_history_log(const std::filesystem::path &path);
+
+// A log image of the first digests.size() entries of history, with each
+// distinct payload written once.
+std::string encode_history_log(const ClipboardHistory &history, const std::vector<EntryDigest> &digests);
+// Atomically replaces the log at path with log_data.
+bool replace_history_log(const std::filesystem::path &path, std::string_view log_data);
+bool write_history_log(const std::filesystem::path &path, const ClipboardHistory &history,
+                       const std::vector<EntryDigest> &digests);
+
+class HistoryLog
+{
+public:
+    explicit HistoryLog(std::filesystem::path path = history_path(), HistoryLimits limits = {})
+        : path(std::move(path)), blobs(blob_directory(this->path)), limits(limits) {}
+
+    HistoryLog(const HistoryLog &) = delete;
+    HistoryLog &operator=(const HistoryLog &) = delete;
+
+    ClipboardHistory open();
+    bool push_front(ClipboardHistory &history, ClipboardEntry entry);
+    bool push_front(ClipboardHistory &history, ClipboardEntry entry, EntryDigest digest);
+    bool erase(ClipboardHistory &history, std::size_t index);
+    // Moves an existing entry to the front without rewriting its payloads.
+    bool promote(ClipboardHistory &history, std::size_t index);
+
+    // Hands later writes to a LogWriter thread, so the calls above only
+    // encode records and return; they report failures of earlier writes.
+    void write_in_background(std::chrono::milliseconds window);
+    // Waits for background writes. Returns false if the log has failed.
+    bool flush();
+    std::uint64_t coalesced_writes() const { return writer ? writer->coalesced_writes() : 0; }
+    // The background writer's latencies; null before write_in_background.
+    const LogWriter *background_writer() const { return writer.get(); }
+
+    // Position of an entry with the same content, looked up by hash only.
+    std::optional<std::size_t> find(const EntryDigest &digest) const;
+    const EntryDigest &digest(std::size_t index) const { return digests[index]; }
+    // Size of the distinct payloads the history refers to.
+    std::uint64_t payload_bytes() const { return live_bytes; }
+
+private:
+    struct StoredPayload
+    {
+        std::uint64_t record_size = 0;
+        std::uint64_t bytes = 0;
+        std::size_t refs = 0;
+        bool blob = false;
+    };
+
+    std::filesystem::path path;
+    std::filesystem::path blobs;
+    HistoryLimits limits;
+    UniqueFd fd;
+    std::unique_ptr<LogWriter> writer;
+    std::vector<EntryDigest> digests;
+    std::unordered_map<std::uint64_t, std::size_t> entry_hashes;
+    std::unordered_map<std::uint64_t, StoredPayload> payloads;
+    // Blobs whose last reference went away. Their files are removed at the
+    // end of the next push, which may still reuse them: the watcher erases
+    // a variant of the newest entry right before pushing its replacement.
+    std::vector<std::uint64_t> released_blobs;
+    std::uint64_t file_size = 0;
+    std::uint64_t live_size = 0;
+    std::uint64_t live_bytes = 0;
+    bool needs_rewrite = false;
+
+    bool compact(const ClipboardHistory &history);
+    void reset_layout(const ClipboardHistory &history);
+    void track_payload(std::uint64_t hash, const Payload &payload);
+    void remove_dead_blobs() const;
+    // Copies the log to a .damaged file next to it before it is replaced.
+    void preserve_damaged_log() const;
+    void remove_released_blobs();
+    void add_entry_refs(const EntryDigest &digest);
+    void release_entry_refs(const EntryDigest &digest);
+    // Evicts entries past the limits and returns their erase records.
+    std::string trim(ClipboardHistory &history);
+    bool append_records(std::string records);
+    bool open_for_append();
+    // After a failed write, only a whole new log is consistent again.
+    bool must_rewrite() const;
+    bool should_compact() const;
+};
+}
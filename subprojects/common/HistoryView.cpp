@@ -0,0 +1,255 @@
+#include "HistoryView.h"
+#include "FuzzyMatch.h"
+#include "StringUtils.h"
+#include "TextSearch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <iostream>
+
+namespace clipboard
+{
+std::optional<std::string_view> EntryView::find(std::string_view mime) const
+{
+    const auto id = find_mime(mime);
+    return id ? find(*id) : std::nullopt;
+}
+
+std::optional<std::string_view> EntryView::find(MimeId mime) const
+{
+    const auto it = std::ranges::find(payloads, mime, &PayloadViews::value_type::first);
+    if (it == payloads.end())
+    {
+        return std::nullopt;
+    }
+    return it->second.data();
+}
+
+const Payload *EntryView::payload(std::string_view mime) const
+{
+    const auto id = find_mime(mime);
+    if (!id)
+    {
+        return nullptr;
+    }
+    const auto it = std::ranges::find(payloads, *id, &PayloadViews::value_type::first);
+    return it == payloads.end() ? nullptr : &it->second;
+}
+
+ClipboardEntry EntryView::to_entry() const
+{
+    ClipboardEntry entry;
+    for (const auto &[mime, payload] : payloads)
+    {
+        entry.insert_or_assign(mime, std::string(payload.data()));
+    }
+    return entry;
+}
+
+std::string picker_label(std::size_t index, const EntryView &entry, std::string_view separator)
+{
+    const std::string_view partial = entry.summary.partial ? "[partial] " : "";
+    if (!entry.summary.preview.empty())
+    {
+        return std::format("{}{}{}{}", index + 1, separator, partial, entry.summary.preview);
+    }
+    if (!entry.empty())
+    {
+        return std::format("{}{}{}Non-text Clipboard Entry ({})", index + 1, separator, partial,
+                           mime_name(entry.payloads.front().first));
+    }
+    return std::format("{}{}{}Non-text Clipboard Entry", index + 1, separator, partial);
+}
+
+std::string_view fuzzy_match_text(const EntryView &entry)
+{
+    if (!entry.summary.preview.empty() || entry.empty())
+    {
+        return entry.summary.preview;
+    }
+    return mime_name(entry.payloads.front().first);
+}
+
+std::optional<std::size_t> picker_label_index(std::string_view label, std::string_view separator)
+{
+    std::size_t position = 0;
+    const auto [end, error] = std::from_chars(label.data(), label.data() + label.size(), position);
+    if (error != std::errc() || position == 0)
+    {
+        return std::nullopt;
+    }
+    if (!label.substr(static_cast<std::size_t>(end - label.data())).starts_with(separator))
+    {
+        return std::nullopt;
+    }
+    return position - 1;
+}
+
+bool HistoryView::may_have_entries(const std::filesystem::path &path)
+{
+    std::error_code error;
+    const auto size = std::filesystem::file_size(path, error);
+    if (!error)
+    {
+        return size > encode_log_header().size();
+    }
+    // Let open() report anything but a missing log.
+    if (error != std::errc::no_such_file_or_directory)
+    {
+        return true;
+    }
+    if (path != history_path())
+    {
+        return false;
+    }
+    const auto legacy_size = std::filesystem::file_size(legacy_history_path(), error);
+    return !error && legacy_size > 0;
+}
+
+bool HistoryView::open(const std::filesystem::path &path)
+{
+    entries.clear();
+    blobs.clear();
+    file = std::make_shared<MappedFile>();
+    trigram_filters = false;
+    if (path.empty())
+    {
+        std::cerr << "Cannot load clipboard history: XDG_DATA_HOME and HOME are unset" << std::endl;
+        return false;
+    }
+
+    if (!file->open(path))
+    {
+        if (errno != ENOENT)
+        {
+            std::cerr << "Failed to map clipboard history at " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        // The watcher has not migrated the legacy history yet.
+        if (path != history_path())
+        {
+            return true;
+        }
+        for (const auto &entry : load_history())
+        {
+            EntryView view;
+            view.payloads.assign(entry.begin(), entry.end());
+            auto digest = digest_entry(entry);
+            view.hash = digest.hash;
+            view.summary = std::move(digest.summary);
+            entries.push_back(std::move(view));
+        }
+        return true;
+    }
+
+    try
+    {
+        const auto index = index_history_log(file->data());
+        trigram_filters = index.trigram_filters;
+        const auto blob_dir = blob_directory(path);
+        std::vector<LogPayload> payloads;
+        entries.resize(index.entries.size());
+        for (std::size_t i = 0; i < index.entries.size(); ++i)
+        {
+            decode_push_record(index.entries[i], index, payloads, &entries[i].summary, &entries[i].trigrams);
+            std::vector<std::pair<MimeId, std::uint64_t>> hashes;
+            hashes.reserve(payloads.size());
+            for (const auto &payload : payloads)
+            {
+                hashes.emplace_back(intern_mime(payload.mime), payload.hash);
+            }
+            entries[i].payloads.reserve(payloads.size());
+            for (std::size_t p = 0; p < payloads.size(); ++p)
+            {
+                const auto &payload = payloads[p];
+                const auto mime = hashes[p].first;
+                if (payload.codec != Codec::none)
+                {
+                    entries[i].payloads.emplace_back(
+                        mime, Payload::compressed(file, payload.data, payload.codec, payload.size, payload.hash));
+                    continue;
+                }
+                if (!payload.blob)
+                {
+                    entries[i].payloads.emplace_back(mime, Payload::mapped(file, payload.data, payload.hash));
+                    continue;
+                }
+                auto [blob, inserted] = blobs.try_emplace(payload.hash, std::make_shared<MappedFile>());
+                if (inserted && !blob->second->open(blob_path(blob_dir, payload.hash)))
+                {
+                    std::cerr << "Missing clipboard blob " << blob_path(blob_dir, payload.hash) << ": "
+                              << std::strerror(errno) << std::endl;
+                }
+                // A blob that was replaced or removed under us is skipped
+                // rather than served with the wrong size.
+                if (blob->second->data().size() == payload.blob_size)
+                {
+                    entries[i].payloads.emplace_back(mime, Payload::mapped(blob->second, blob->second->data(), payload.hash));
+                }
+            }
+            entries[i].hash = make_entry_digest(std::move(hashes)).hash;
+            // Until the watcher rewrites an older log, previews come from the
+            // payloads.
+            if (!index.summaries)
+            {
+                if (const auto text = entries[i].find(text_plain_mime))
+                {
+                    entries[i].summary.preview = single_line_preview(*text);
+                }
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Ignoring invalid clipboard history at " << path << ": " << e.what() << std::endl;
+        entries.clear();
+        file.reset();
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::size_t> HistoryView::search(std::string_view query) const
+{
+    const TextQuery text_query(query);
+    std::vector<std::size_t> found;
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        if (trigram_filters && !text_query.may_match(entries[i].trigrams))
+        {
+            continue;
+        }
+        if (const auto text = entries[i].find(text_plain_mime); text && text_query.matches(*text))
+        {
+            found.push_back(i);
+        }
+    }
+    return found;
+}
+
+std::optional<std::size_t> HistoryView::best_fuzzy_match(const std::vector<std::size_t> &indexes,
+                                                         std::string_view query) const
+{
+    const FuzzyQuery fuzzy_query(query);
+    std::optional<std::size_t> best;
+    int best_score = 0;
+    for (const auto index : indexes)
+    {
+        if (index >= entries.size() || entries[index].empty())
+        {
+            continue;
+        }
+        const auto score = fuzzy_query.score(fuzzy_match_text(entries[index]));
+        if (score && (!best || *score > best_score))
+        {
+            best = index;
+            best_score = *score;
+        }
+    }
+    return best;
+}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "ClipboardHistory.h"
+#include "HistoryLog.h"
+#include "PosixIO.h"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace clipboard
+{
+struct EntryView
+{
+    PayloadViews payloads;
+    // EntryDigest::hash of the entry.
+    std::uint64_t hash = 0;
+    // The trigram filter in the mapped log; summary.trigrams is not filled.
+    EntrySummary summary;
+    std::string_view trigrams;
+
+    bool empty() const { return payloads.empty(); }
+    std::optional<std::string_view> find(MimeId mime) const;
+    std::optional<std::string_view> find(std::string_view mime) const;
+    // The payload of a MIME type, or nullptr.
+    const Payload *payload(std::string_view mime) const;
+    ClipboardEntry to_entry() const;
+};
+
+// Separates the 1-based history position from the rest of a picker label.
+inline constexpr std::string_view default_label_separator = ": ";
+
+// The line wl-copy-picker shows for an entry, prefixed with its 1-based
+// history position and the separator. Partial entries are marked.
+std::string picker_label(std::size_t index, const EntryView &entry,
+                         std::string_view separator = default_label_separator);
+
+// The 0-based history index a picker label starts with, or std::nullopt if
+// it does not start with a position followed by the separator.
+std::optional<std::size_t> picker_label_index(std::string_view label,
+                                              std::string_view separator = default_label_separator);
+
+// The text a fuzzy query is matched against: the entry's preview, or its
+// first MIME type when it has no text, as in its picker label.
+std::string_view fuzzy_match_text(const EntryView &entry);
+
+// Read-only view of the history log. Entries and payloads point into the
+// mapped file, so opening the view only walks the record headers and never
+// copies payload bytes; blob payloads are mapped from their own files and
+// compressed payloads are decoded when they are read. A legacy JSON history
+// is decoded into memory instead.
+class HistoryView
+{
+public:
+    HistoryView() = default;
+
+    HistoryView(const HistoryView &) = delete;
+    HistoryView &operator=(const HistoryView &) = delete;
+
+    bool open(const std::filesystem::path &path = history_path());
+    // Whether the history at path may hold entries, judged from file sizes
+    // alone: its log is longer than a bare header, or a legacy history is
+    // still waiting to be migrated.
+    static bool may_have_entries(const std::filesystem::path &path = history_path());
+
+    std::size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    const EntryView &operator[](std::size_t index) const { return entries[index]; }
+    const EntryView &front() const { return entries.front(); }
+    auto begin() const { return entries.begin(); }
+    auto end() const { return entries.end(); }
+
+    // Indexes of the entries whose text contains query, ignoring ASCII
+    // case, newest first. Only entries the trigram filters admit have their
+    // text read.
+    std::vector<std::size_t> search(std::string_view query) const;
+    // Of the entries at indexes, the one whose fuzzy_match_text scores best
+    // against query; the earlier index wins ties. Empty entries never match.
+    std::optional<std::size_t> best_fuzzy_match(const std::vector<std::size_t> &indexes, std::string_view query) const;
+
+private:
+    std::shared_ptr<MappedFile> file;
+    std::unordered_map<std::uint64_t, std::shared_ptr<MappedFile>> blobs;
+    std::vector<EntryView> entries;
+    // Logs older than the filters, and legacy histories, are searched by
+    // reading every text.
+    bool trigram_filters = false;
+};
+}
@@ -0,0 +1,141 @@
+#include "LogWriter.h"
+#include "HistoryLog.h"
+
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+
+namespace clipboard
+{
+LogWriter::LogWriter(std::filesystem::path path, std::chrono::milliseconds window)
+    : path(std::move(path)), window(window)
+{
+    // The thread inherits a mask blocking every signal, so signals meant for
+    // the owner's SignalFd cannot be delivered to it and kill the process
+    // before pending writes are flushed.
+    sigset_t all;
+    sigset_t previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    thread = std::thread([this]
+                         { run(); });
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+LogWriter::~LogWriter()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void LogWriter::append(std::string records)
+{
+    {
+        std::lock_guard lock(mutex);
+        if (pending_jobs++ == 0)
+        {
+            oldest_pending = std::chrono::steady_clock::now();
+        }
+        pending_appends.push_back(std::move(records));
+    }
+    wake.notify_one();
+}
+
+void LogWriter::replace(std::string log_data)
+{
+    {
+        std::lock_guard lock(mutex);
+        if (pending_jobs++ == 0)
+        {
+            oldest_pending = std::chrono::steady_clock::now();
+        }
+        pending_replacement = std::move(log_data);
+        pending_appends.clear();
+    }
+    wake.notify_one();
+}
+
+bool LogWriter::flush()
+{
+    std::unique_lock lock(mutex);
+    flush_requested = true;
+    wake.notify_one();
+    idle.wait(lock, [this]
+              { return pending_jobs == 0 && !writing; });
+    return !failed_.load();
+}
+
+void LogWriter::run()
+{
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]
+                  { return pending_jobs > 0 || stopping; });
+        if (pending_jobs == 0)
+        {
+            break;
+        }
+        // Let later jobs join the batch unless someone is waiting for it.
+        wake.wait_until(lock, oldest_pending + window, [this]
+                        { return flush_requested || stopping; });
+
+        auto replacement = std::exchange(pending_replacement, std::nullopt);
+        auto appends = std::exchange(pending_appends, {});
+        coalesced += pending_jobs - 1;
+        pending_jobs = 0;
+        writing = true;
+        lock.unlock();
+        const auto started = std::chrono::steady_clock::now();
+        write_batch(std::move(replacement), appends);
+        write_times.observe(std::chrono::steady_clock::now() - started);
+        lock.lock();
+        writing = false;
+        if (pending_jobs == 0)
+        {
+            flush_requested = false;
+            idle.notify_all();
+        }
+    }
+}
+
+void LogWriter::write_batch(std::optional<std::string> replacement, const std::vector<std::string> &appends)
+{
+    if (replacement)
+    {
+        fd.reset();
+        failed_ = !replace_history_log(path, *replacement);
+    }
+    if (appends.empty() || failed_)
+    {
+        return;
+    }
+    if (!fd.valid())
+    {
+        fd.reset(::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC));
+    }
+    bool ok = fd.valid();
+    for (const auto &records : appends)
+    {
+        ok = ok && write_all(fd.get(), records);
+    }
+    if (ok)
+    {
+        const auto started = std::chrono::steady_clock::now();
+        ok = fdatasync(fd.get()) == 0;
+        sync_times.observe(std::chrono::steady_clock::now() - started);
+    }
+    if (!ok)
+    {
+        perror("append clipboard history");
+        fd.reset();
+        failed_ = true;
+    }
+}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Metrics.h"
+#include "PosixIO.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace clipboard
+{
+// Writes a history log on a background thread so its owner never waits on
+// the disk. Work queued within window of the oldest pending job is written
+// as one batch: appends share one write and one fdatasync, and a replacement
+// drops the appends queued before it, since it already holds their effect.
+class LogWriter
+{
+public:
+    LogWriter(std::filesystem::path path, std::chrono::milliseconds window);
+    // Writes whatever is still queued.
+    ~LogWriter();
+
+    LogWriter(const LogWriter &) = delete;
+    LogWriter &operator=(const LogWriter &) = delete;
+
+    void append(std::string records);
+    // log_data is a whole log image, as from encode_history_log.
+    void replace(std::string log_data);
+    // Blocks until everything queued so far is written. Returns false if the
+    // log has failed.
+    bool flush();
+    // Set when a write fails and cleared when a replacement succeeds; the
+    // owner should replace the log meanwhile.
+    bool failed() const { return failed_.load(); }
+    // Jobs written as part of an earlier job's batch instead of on their own.
+    std::uint64_t coalesced_writes() const { return coalesced.load(); }
+    // Time spent on each batch, and on the fdatasync ending a batch of appends.
+    const LatencyHistogram &write_latency() const { return write_times; }
+    const LatencyHistogram &sync_latency() const { return sync_times; }
+
+private:
+    void run();
+    void write_batch(std::optional<std::string> replacement, const std::vector<std::string> &appends);
+
+    std::filesystem::path path;
+    std::chrono::milliseconds window;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::optional<std::string> pending_replacement;
+    // Kept apart rather than concatenated, which would copy large records.
+    std::vector<std::string> pending_appends;
+    std::uint64_t pending_jobs = 0;
+    std::chrono::steady_clock::time_point oldest_pending;
+    bool flush_requested = false;
+    bool writing = false;
+    bool stopping = false;
+
+    std::atomic<bool> failed_{false};
+    std::atomic<std::uint64_t> coalesced{0};
+    LatencyHistogram write_times;
+    LatencyHistogram sync_times;
+    // Only used by the writer thread.
+    UniqueFd fd;
+    std::thread thread;
+};
+}
@@ -0,0 +1,134 @@
+#include "Metrics.h"
+#include "PosixIO.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <format>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clipboard
+{
+void LatencyHistogram::observe(std::chrono::nanoseconds elapsed)
+{
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const auto bucket = std::ranges::lower_bound(bounds, seconds) - bounds.begin();
+    buckets[static_cast<std::size_t>(bucket)].fetch_add(1, std::memory_order_relaxed);
+    sum_ns.fetch_add(static_cast<std::uint64_t>(std::max<std::int64_t>(elapsed.count(), 0)), std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::cumulative_count(std::size_t i) const
+{
+    std::uint64_t total = 0;
+    for (std::size_t b = 0; b <= i && b < buckets.size(); ++b)
+    {
+        total += buckets[b].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+double LatencyHistogram::sum_seconds() const
+{
+    return static_cast<double>(sum_ns.load(std::memory_order_relaxed)) / 1e9;
+}
+
+void MetricsText::family(std::string_view name, std::string_view type, std::string_view help)
+{
+    text += std::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void MetricsText::sample(std::string_view name, std::uint64_t value, MetricLabels labels)
+{
+    text += name;
+    write_labels(labels);
+    text += std::format(" {}\n", value);
+}
+
+void MetricsText::histogram(std::string_view name, const LatencyHistogram &histogram, MetricLabels labels)
+{
+    for (std::size_t i = 0; i <= LatencyHistogram::bounds.size(); ++i)
+    {
+        text += name;
+        text += "_bucket";
+        write_labels(labels, i < LatencyHistogram::bounds.size() ? std::format("{}", LatencyHistogram::bounds[i]) : "+Inf");
+        text += std::format(" {}\n", histogram.cumulative_count(i));
+    }
+    text += name;
+    text += "_sum";
+    write_labels(labels);
+    text += std::format(" {}\n", histogram.sum_seconds());
+    text += name;
+    text += "_count";
+    write_labels(labels);
+    text += std::format(" {}\n", histogram.count());
+}
+
+void MetricsText::write_labels(MetricLabels labels, std::string_view le)
+{
+    if (labels.size() == 0 && le.empty())
+    {
+        return;
+    }
+    text += '{';
+    bool first = true;
+    const auto write_label = [&](std::string_view name, std::string_view value)
+    {
+        if (!first)
+        {
+            text += ',';
+        }
+        first = false;
+        text += name;
+        text += "=\"";
+        for (const char c : value)
+        {
+            if (c == '\\' || c == '"')
+            {
+                text += '\\';
+                text += c;
+            }
+            else if (c == '\n')
+            {
+                text += "\\n";
+            }
+            else
+            {
+                text += c;
+            }
+        }
+        text += '"';
+    };
+    for (const auto &[name, value] : labels)
+    {
+        write_label(name, value);
+    }
+    if (!le.empty())
+    {
+        write_label("le", le);
+    }
+    text += '}';
+}
+
+bool write_metrics_file(const std::filesystem::path &path, std::string_view text)
+{
+    auto tmp_template = path;
+    tmp_template += ".tmp.XXXXXX";
+    std::string tmp_name = tmp_template.string();
+    UniqueFd fd(mkstemp(tmp_name.data()));
+    if (!fd.valid())
+    {
+        perror("mkstemp");
+        return false;
+    }
+    // mkstemp creates the file private; scrapers may run as another user.
+    fchmod(fd.get(), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    const bool ok = write_all(fd.get(), text) && close(fd.release()) == 0 &&
+                    std::rename(tmp_name.c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        perror("write metrics file");
+        unlink(tmp_name.c_str());
+    }
+    return ok;
+}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace clipboard
+{
+// Latency distribution over fixed buckets from 100us to 10s. Observations
+// are lock-free, so another thread may record while the owner renders.
+class LatencyHistogram
+{
+public:
+    static constexpr std::array<double, 16> bounds = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+                                                       0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+    void observe(std::chrono::nanoseconds elapsed);
+
+    // Observations no longer than bounds[i]; index bounds.size() is +Inf.
+    std::uint64_t cumulative_count(std::size_t i) const;
+    std::uint64_t count() const { return cumulative_count(bounds.size()); }
+    double sum_seconds() const;
+
+private:
+    std::array<std::atomic<std::uint64_t>, bounds.size() + 1> buckets{};
+    std::atomic<std::uint64_t> sum_ns{0};
+};
+
+using MetricLabels = std::initializer_list<std::pair<std::string_view, std::string_view>>;
+
+// Builds a page in the Prometheus text exposition format. Each family()
+// call is followed by the samples of that family.
+class MetricsText
+{
+public:
+    // type is "counter", "gauge" or "histogram".
+    void family(std::string_view name, std::string_view type, std::string_view help);
+    void sample(std::string_view name, std::uint64_t value, MetricLabels labels = {});
+    // The _bucket, _sum and _count samples of a histogram family.
+    void histogram(std::string_view name, const LatencyHistogram &histogram, MetricLabels labels = {});
+
+    const std::string &str() const { return text; }
+
+private:
+    std::string text;
+
+    void write_labels(MetricLabels labels, std::string_view le = {});
+};
+
+// Replaces path with text through a rename, so readers such as the node
+// exporter's textfile collector never see a partial page.
+bool write_metrics_file(const std::filesystem::path &path, std::string_view text);
+}
@@ -0,0 +1,65 @@
+#include "MimeType.h"
+
+#include <unordered_map>
+
+namespace clipboard
+{
+namespace
+{
+struct MimeTable
+{
+    std::mutex mutex;
+    // A deque never moves its elements, so ids map to stable names and the
+    // index can key on views of them.
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, MimeId> ids;
+
+    MimeTable()
+    {
+        add("text/plain");
+    }
+
+    MimeId add(std::string_view mime)
+    {
+        const auto id = static_cast<MimeId>(names.size());
+        ids.emplace(names.emplace_back(mime), id);
+        return id;
+    }
+};
+
+MimeTable &mime_table()
+{
+    static MimeTable table;
+    return table;
+}
+}
+
+MimeId intern_mime(std::string_view mime)
+{
+    auto &table = mime_table();
+    std::lock_guard lock(table.mutex);
+    if (const auto it = table.ids.find(mime); it != table.ids.end())
+    {
+        return it->second;
+    }
+    return table.add(mime);
+}
+
+std::optional<MimeId> find_mime(std::string_view mime)
+{
+    auto &table = mime_table();
+    std::lock_guard lock(table.mutex);
+    if (const auto it = table.ids.find(mime); it != table.ids.end())
+    {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+const std::string &mime_name(MimeId id)
+{
+    return MimeNames()[id];
+}
+
+MimeNames::MimeNames() : lock(mime_table().mutex), names(mime_table().names) {}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace clipboard
+{
+// A MIME type interned in a process-wide table. Entries, digests and offers
+// carry these instead of their own copies of the name; ids stay valid, and
+// name the same type, for the life of the process.
+using MimeId = std::uint32_t;
+
+// Seeded first so the watcher and picker can name it without a lookup.
+inline constexpr MimeId text_plain_mime = 0;
+
+MimeId intern_mime(std::string_view mime);
+// The id of an already interned type. Lookups by peers' requests use this so
+// they cannot grow the table.
+std::optional<MimeId> find_mime(std::string_view mime);
+const std::string &mime_name(MimeId id);
+
+// Holds the table lock so a comparator can look up many names for the price
+// of one lock. Nothing may be interned while it is held.
+class MimeNames
+{
+public:
+    MimeNames();
+    const std::string &operator[](MimeId id) const { return names.at(id); }
+
+private:
+    std::unique_lock<std::mutex> lock;
+    const std::deque<std::string> &names;
+};
+}
@@ -0,0 +1,165 @@
+#include "PayloadCodec.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <lz4.h>
+#include <zstd.h>
+
+namespace clipboard
+{
+namespace
+{
+// Below this, the record header outweighs what compression saves.
+constexpr std::size_t min_compressed_size = 256;
+constexpr int zstd_level = 3;
+
+// Sorted for binary_search.
+constexpr std::array compressed_formats{
+    std::string_view("application/gzip"),
+    std::string_view("application/vnd.rar"),
+    std::string_view("application/x-7z-compressed"),
+    std::string_view("application/x-bzip2"),
+    std::string_view("application/x-gzip"),
+    std::string_view("application/x-xz"),
+    std::string_view("application/zip"),
+    std::string_view("application/zstd"),
+    std::string_view("font/woff2"),
+    std::string_view("image/avif"),
+    std::string_view("image/gif"),
+    std::string_view("image/heic"),
+    std::string_view("image/jpeg"),
+    std::string_view("image/jpg"),
+    std::string_view("image/jxl"),
+    std::string_view("image/png"),
+    std::string_view("image/webp"),
+};
+
+// X11 selection targets that carry text, sorted.
+constexpr std::array text_targets{
+    std::string_view("compound_text"),
+    std::string_view("string"),
+    std::string_view("text"),
+    std::string_view("utf8_string"),
+};
+
+// Lowercased, without parameters such as ";charset=utf-8".
+std::string essence(std::string_view mime)
+{
+    mime = mime.substr(0, mime.find(';'));
+    while (!mime.empty() && std::isspace(static_cast<unsigned char>(mime.back())))
+    {
+        mime.remove_suffix(1);
+    }
+    std::string type(mime);
+    std::ranges::transform(type, type.begin(), [](unsigned char c)
+                           { return static_cast<char>(std::tolower(c)); });
+    return type;
+}
+
+bool is_text(std::string_view type)
+{
+    return type.starts_with("text/") || std::ranges::binary_search(text_targets, type) || type == "application/json" ||
+           type == "application/xml" || type == "application/javascript" || type.ends_with("+json") ||
+           type.ends_with("+xml");
+}
+
+bool worth_keeping(std::size_t compressed_size, std::size_t size)
+{
+    return compressed_size <= size - size / 8;
+}
+}
+
+Codec codec_for_mime(std::string_view mime)
+{
+    const auto type = essence(mime);
+    if (type.starts_with("audio/") || type.starts_with("video/") || std::ranges::binary_search(compressed_formats, type))
+    {
+        return Codec::none;
+    }
+    return is_text(type) ? Codec::lz4 : Codec::zstd;
+}
+
+std::optional<std::string> compress_payload(Codec codec, std::string_view data)
+{
+    if (codec == Codec::none || data.size() < min_compressed_size)
+    {
+        return std::nullopt;
+    }
+
+    std::string out;
+    if (codec == Codec::lz4)
+    {
+        if (data.size() > LZ4_MAX_INPUT_SIZE)
+        {
+            return std::nullopt;
+        }
+        const auto size = static_cast<int>(data.size());
+        out.resize(static_cast<std::size_t>(LZ4_compressBound(size)));
+        const int written = LZ4_compress_default(data.data(), out.data(), size, static_cast<int>(out.size()));
+        if (written <= 0)
+        {
+            return std::nullopt;
+        }
+        out.resize(static_cast<std::size_t>(written));
+    }
+    else if (codec == Codec::zstd)
+    {
+        out.resize(ZSTD_compressBound(data.size()));
+        const auto written = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), zstd_level);
+        if (ZSTD_isError(written))
+        {
+            return std::nullopt;
+        }
+        out.resize(written);
+    }
+    else
+    {
+        return std::nullopt;
+    }
+
+    if (!worth_keeping(out.size(), data.size()))
+    {
+        return std::nullopt;
+    }
+    out.shrink_to_fit();
+    return out;
+}
+
+std::optional<std::string> decompress_payload(Codec codec, std::string_view data, std::uint64_t size)
+{
+    std::string out;
+    if (codec == Codec::lz4)
+    {
+        // LZ4 cannot expand input more than 255 times.
+        if (size > LZ4_MAX_INPUT_SIZE || data.size() > LZ4_MAX_INPUT_SIZE || size / 255 > data.size())
+        {
+            return std::nullopt;
+        }
+        out.resize(size);
+        const int read = LZ4_decompress_safe(data.data(), out.data(), static_cast<int>(data.size()), static_cast<int>(size));
+        if (read < 0 || static_cast<std::uint64_t>(read) != size)
+        {
+            return std::nullopt;
+        }
+        return out;
+    }
+    if (codec == Codec::zstd)
+    {
+        // The frame header records the content size; refuse frames that
+        // disagree with the record before allocating for them.
+        if (ZSTD_getFrameContentSize(data.data(), data.size()) != size)
+        {
+            return std::nullopt;
+        }
+        out.resize(size);
+        const auto read = ZSTD_decompress(out.data(), out.size(), data.data(), data.size());
+        if (ZSTD_isError(read) || read != size)
+        {
+            return std::nullopt;
+        }
+        return out;
+    }
+    return std::nullopt;
+}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace clipboard
+{
+// Compression of inline payloads in the history log. The values are stored
+// in compressed payload records.
+enum class Codec : std::uint32_t
+{
+    none = 0,
+    // Fast enough that text reads back at memory speed.
+    lz4 = 1,
+    // Smaller output for binary data that is not compressed already.
+    zstd = 2,
+};
+
+// none for formats that are compressed already (PNG, JPEG, archives, ...),
+// lz4 for text and zstd for other data.
+Codec codec_for_mime(std::string_view mime);
+
+// Returns std::nullopt for Codec::none, for payloads too small to bother
+// with, and when the output would not be meaningfully smaller.
+std::optional<std::string> compress_payload(Codec codec, std::string_view data);
+// Returns std::nullopt unless data decodes to exactly size bytes.
+std::optional<std::string> decompress_payload(Codec codec, std::string_view data, std::uint64_t size);
+}
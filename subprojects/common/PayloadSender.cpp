@@ -0,0 +1,79 @@
+#include "PayloadSender.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/epoll.h>
+
+namespace clipboard
+{
+void PayloadSender::send(UniqueFd fd, std::string_view data, std::shared_ptr<const void> owner, bool file_backed)
+{
+    if (data.empty())
+    {
+        return;
+    }
+    if (!set_nonblocking(fd.get()))
+    {
+        perror("fcntl");
+        return;
+    }
+
+    const int key = fd.get();
+    Transfer transfer;
+    transfer.fd = std::move(fd);
+    transfer.data = data;
+    transfer.owner = std::move(owner);
+    transfer.use_vmsplice = file_backed;
+    transfers.insert_or_assign(key, std::move(transfer));
+    if (!loop.add(key, EPOLLOUT, [this, key](std::uint32_t)
+                  { resume(key); }))
+    {
+        transfers.erase(key);
+        return;
+    }
+    // Most targets take a small payload right away.
+    resume(key);
+}
+
+void PayloadSender::clear()
+{
+    for (const auto &[fd, transfer] : transfers)
+    {
+        loop.remove(fd);
+    }
+    transfers.clear();
+}
+
+void PayloadSender::resume(int fd)
+{
+    const auto it = transfers.find(fd);
+    if (it == transfers.end())
+    {
+        return;
+    }
+
+    auto &transfer = it->second;
+    while (!transfer.data.empty())
+    {
+        ssize_t n = write_some(fd, transfer.data, transfer.use_vmsplice);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (n <= 0)
+        {
+            std::cerr << "Failed to write to fd: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        transfer.data.remove_prefix(static_cast<std::size_t>(n));
+    }
+    finish(fd);
+}
+
+void PayloadSender::finish(int fd)
+{
+    loop.remove(fd);
+    transfers.erase(fd);
+}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "EventLoop.h"
+#include "PosixIO.h"
+
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+namespace clipboard
+{
+// Feeds payloads to paste fds from an event loop without blocking, so a slow
+// reader only delays its own transfer.
+class PayloadSender
+{
+public:
+    explicit PayloadSender(EventLoop &loop) : loop(loop) {}
+    ~PayloadSender() { clear(); }
+
+    PayloadSender(const PayloadSender &) = delete;
+    PayloadSender &operator=(const PayloadSender &) = delete;
+
+    // data must stay valid until the transfer ends; owner is held until then.
+    // Pipes keep references to vmspliced pages after the transfer ends, until
+    // the reader consumes them, so only file_backed data, which lies in a
+    // mapping that is never modified, is vmspliced; other data is copied.
+    void send(UniqueFd fd, std::string_view data, std::shared_ptr<const void> owner = nullptr,
+              bool file_backed = false);
+    bool empty() const { return transfers.empty(); }
+    std::size_t size() const { return transfers.size(); }
+    void clear();
+
+private:
+    struct Transfer
+    {
+        UniqueFd fd;
+        std::string_view data;
+        std::shared_ptr<const void> owner;
+        bool use_vmsplice = false;
+    };
+
+    EventLoop &loop;
+    std::unordered_map<int, Transfer> transfers;
+
+    void resume(int fd);
+    void finish(int fd);
+};
+}
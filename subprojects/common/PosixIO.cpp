@@ -2,6 +2,9 @@
 
 #include <cerrno>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace clipboard
@@ -38,6 +41,69 @@ void UniqueFd::reset(int fd)
     fd_ = fd;
 }
 
+MappedFile::~MappedFile()
+{
+    reset();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept : addr_(other.addr_), size_(other.size_)
+{
+    other.addr_ = nullptr;
+    other.size_ = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        addr_ = other.addr_;
+        size_ = other.size_;
+        other.addr_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::filesystem::path &path)
+{
+    reset();
+    UniqueFd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd.valid())
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd.get(), &st) != 0)
+    {
+        return false;
+    }
+    if (st.st_size == 0)
+    {
+        return true;
+    }
+
+    void *addr = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (addr == MAP_FAILED)
+    {
+        return false;
+    }
+    addr_ = addr;
+    size_ = static_cast<std::size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::reset()
+{
+    if (addr_)
+    {
+        munmap(addr_, size_);
+    }
+    addr_ = nullptr;
+    size_ = 0;
+}
+
 bool set_nonblocking(int fd)
 {
     int flags = fcntl(fd, F_GETFL);
@@ -71,8 +137,35 @@ bool write_all(int fd, const char *data, std::size_t size)
     return true;
 }
 
-bool write_all(int fd, const std::string &data)
+bool write_all(int fd, std::string_view data)
 {
     return write_all(fd, data.data(), data.size());
 }
+
+ssize_t write_some(int fd, std::string_view data, bool &use_vmsplice)
+{
+    while (true)
+    {
+        ssize_t n = 0;
+        if (use_vmsplice)
+        {
+            iovec iov{.iov_base = const_cast<char *>(data.data()), .iov_len = data.size()};
+            n = vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+            if (n < 0 && (errno == EBADF || errno == EINVAL))
+            {
+                use_vmsplice = false;
+                continue;
+            }
+        }
+        else
+        {
+            n = write(fd, data.data(), data.size());
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        return n;
+    }
+}
 }
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <cstddef>
+#include <filesystem>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
 
 namespace clipboard
 {
@@ -27,7 +30,37 @@ private:
     int fd_ = -1;
 };
 
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    // Maps the whole file read-only. Returns false and leaves errno set when
+    // the file cannot be opened or mapped.
+    bool open(const std::filesystem::path &path);
+    std::string_view data() const { return {static_cast<const char *>(addr_), size_}; }
+    void reset();
+
+private:
+    void *addr_ = nullptr;
+    std::size_t size_ = 0;
+};
+
 bool set_nonblocking(int fd);
 bool write_all(int fd, const char *data, std::size_t size);
-bool write_all(int fd, const std::string &data);
+bool write_all(int fd, std::string_view data);
+// Writes a prefix of data to a non-blocking fd without waiting. With
+// use_vmsplice, pipes are fed with vmsplice, which passes references to the
+// caller's pages instead of copying them, so data must stay mapped and
+// unmodified until the reader consumes it, even after this returns.
+// use_vmsplice is cleared when fd turns out not to support it. Returns the
+// number of bytes taken, or -1 with errno set (EAGAIN when fd is full).
+ssize_t write_some(int fd, std::string_view data, bool &use_vmsplice);
 }
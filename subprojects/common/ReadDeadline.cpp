@@ -0,0 +1,16 @@
+#include "ReadDeadline.h"
+
+#include <algorithm>
+
+namespace clipboard
+{
+std::chrono::steady_clock::time_point mime_read_deadline(const MimeReadProgress &read,
+                                                         std::chrono::steady_clock::time_point offer_progress,
+                                                         std::chrono::milliseconds idle_timeout,
+                                                         std::chrono::milliseconds read_timeout,
+                                                         std::chrono::steady_clock::time_point offer_deadline)
+{
+    const auto idle_since = read.last_data.value_or(offer_progress);
+    return std::min({idle_since + idle_timeout, read.started_at + read_timeout, offer_deadline});
+}
+}
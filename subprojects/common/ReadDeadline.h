@@ -0,0 +1,26 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+
+namespace clipboard
+{
+// How far one MIME read of an offer has got.
+struct MimeReadProgress
+{
+    std::chrono::steady_clock::time_point started_at;
+    // Unset until the source first writes to the pipe.
+    std::optional<std::chrono::steady_clock::time_point> last_data = std::nullopt;
+};
+
+// When a MIME read is abandoned: idle_timeout after its last data,
+// read_timeout after it started, or at the offer deadline. Sources may write
+// their MIME types one after another, leaving the later pipes silent while an
+// earlier one streams, so a read that has received nothing yet only idles
+// out once no read of the offer has made progress since offer_progress.
+std::chrono::steady_clock::time_point mime_read_deadline(const MimeReadProgress &read,
+                                                         std::chrono::steady_clock::time_point offer_progress,
+                                                         std::chrono::milliseconds idle_timeout,
+                                                         std::chrono::milliseconds read_timeout,
+                                                         std::chrono::steady_clock::time_point offer_deadline);
+}
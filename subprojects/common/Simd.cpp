@@ -0,0 +1,24 @@
+#include "Simd.h"
+
+namespace clipboard
+{
+SimdLevel best_simd_level()
+{
+    static const SimdLevel level = []
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return SimdLevel::avx2;
+        }
+        if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3"))
+        {
+            return SimdLevel::sse41;
+        }
+#endif
+        return SimdLevel::scalar;
+    }();
+    return level;
+}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+namespace clipboard
+{
+// Instruction sets the vectorized code can use, in increasing order. Each
+// level falls back to the scalar code for the tail of the input.
+enum class SimdLevel
+{
+    scalar,
+    sse41,
+    avx2,
+};
+
+// Best level the running CPU supports; detected once.
+SimdLevel best_simd_level();
+}
@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <limits>
 #include <ranges>
 
 namespace clipboard
@@ -26,7 +28,7 @@ void trim(std::string &s)
     rtrim(s);
 }
 
-std::string single_line_preview(const std::string &s, std::size_t max_size)
+std::string single_line_preview(std::string_view s, std::size_t max_size)
 {
     std::string preview;
     preview.reserve(std::min(s.size(), max_size));
@@ -57,4 +59,46 @@ std::string single_line_preview(const std::string &s, std::size_t max_size)
     trim(preview);
     return preview;
 }
+
+std::optional<std::uint64_t> parse_unsigned(std::string_view s)
+{
+    std::uint64_t value = 0;
+    const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (s.empty() || error != std::errc() || end != s.data() + s.size())
+    {
+        return std::nullopt;
+    }
+    return value;
+}
+
+std::optional<std::uint64_t> parse_byte_size(std::string_view s)
+{
+    unsigned shift = 0;
+    if (!s.empty())
+    {
+        switch (std::toupper(static_cast<unsigned char>(s.back())))
+        {
+        case 'K':
+            shift = 10;
+            break;
+        case 'M':
+            shift = 20;
+            break;
+        case 'G':
+            shift = 30;
+            break;
+        }
+        if (shift != 0)
+        {
+            s.remove_suffix(1);
+        }
+    }
+
+    const auto value = parse_unsigned(s);
+    if (!value || *value > (std::numeric_limits<std::uint64_t>::max() >> shift))
+    {
+        return std::nullopt;
+    }
+    return *value << shift;
+}
 }
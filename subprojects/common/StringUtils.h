@@ -1,12 +1,19 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 
 namespace clipboard
 {
 void ltrim(std::string &s);
 void rtrim(std::string &s);
 void trim(std::string &s);
-std::string single_line_preview(const std::string &s, std::size_t max_size = 200);
+std::string single_line_preview(std::string_view s, std::size_t max_size = 200);
+// Parses a decimal unsigned integer with nothing before or after it.
+std::optional<std::uint64_t> parse_unsigned(std::string_view s);
+// Parses a byte count with an optional K, M or G suffix (powers of 1024).
+std::optional<std::uint64_t> parse_byte_size(std::string_view s);
 }
@@ -0,0 +1,162 @@
+#include "TextSearch.h"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+
+namespace clipboard
+{
+namespace
+{
+// Four to eight bits per distinct trigram and two probes keep false
+// positives near one in ten per trigram; queries usually span several.
+constexpr std::size_t bits_per_trigram = 4;
+constexpr std::size_t min_filter_bits = 64;
+// Longer texts share the largest filter and only pass more entries to the
+// substring check.
+constexpr std::size_t max_filter_bits = 64 * 1024;
+// Texts up to this size list and sort their trigrams. Longer ones mark them
+// in a bitmap of every possible trigram instead, so building a filter takes
+// 2 MiB however large the text is.
+constexpr std::size_t sorted_trigrams_limit = 4 * 1024;
+constexpr std::size_t trigram_count = std::size_t(1) << 24;
+
+char fold(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+template <typename Visit>
+void for_each_trigram(std::string_view text, Visit visit)
+{
+    if (text.size() < 3)
+    {
+        return;
+    }
+    std::uint32_t window = (static_cast<std::uint8_t>(fold(text[0])) << 8) | static_cast<std::uint8_t>(fold(text[1]));
+    for (std::size_t i = 2; i < text.size(); ++i)
+    {
+        window = ((window << 8) | static_cast<std::uint8_t>(fold(text[i]))) & 0xffffff;
+        visit(window);
+    }
+}
+
+std::vector<std::uint32_t> trigrams_of(std::string_view text)
+{
+    std::vector<std::uint32_t> trigrams;
+    trigrams.reserve(text.size() > 2 ? text.size() - 2 : 0);
+    for_each_trigram(text, [&](std::uint32_t trigram)
+                     { trigrams.push_back(trigram); });
+    std::ranges::sort(trigrams);
+    const auto duplicates = std::ranges::unique(trigrams);
+    trigrams.erase(duplicates.begin(), duplicates.end());
+    return trigrams;
+}
+
+// Two bit positions per trigram from one multiplicative hash.
+std::uint64_t probe_hash(std::uint32_t trigram)
+{
+    std::uint64_t h = (trigram + 1ull) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+bool test_bit(std::string_view filter, std::uint64_t bit)
+{
+    return (static_cast<std::uint8_t>(filter[bit / 8]) >> (bit % 8)) & 1;
+}
+
+std::string empty_filter(std::size_t distinct_trigrams)
+{
+    if (distinct_trigrams == 0)
+    {
+        return {};
+    }
+    const auto bits = std::clamp(std::bit_ceil(distinct_trigrams * bits_per_trigram), min_filter_bits, max_filter_bits);
+    return std::string(bits / 8, '\0');
+}
+
+void add_trigram(std::string &filter, std::uint32_t trigram)
+{
+    const std::uint64_t bits = filter.size() * 8;
+    const auto h = probe_hash(trigram);
+    for (const auto bit : {h & (bits - 1), (h >> 32) & (bits - 1)})
+    {
+        filter[bit / 8] = static_cast<char>(filter[bit / 8] | (1 << (bit % 8)));
+    }
+}
+}
+
+std::string trigram_filter(std::string_view text)
+{
+    if (text.size() <= sorted_trigrams_limit)
+    {
+        const auto trigrams = trigrams_of(text);
+        auto filter = empty_filter(trigrams.size());
+        for (const auto trigram : trigrams)
+        {
+            add_trigram(filter, trigram);
+        }
+        return filter;
+    }
+
+    std::vector<std::uint64_t> seen(trigram_count / 64);
+    std::size_t distinct = 0;
+    for_each_trigram(text, [&](std::uint32_t trigram)
+                     {
+                         auto &word = seen[trigram / 64];
+                         const auto bit = std::uint64_t(1) << (trigram % 64);
+                         distinct += (word & bit) == 0;
+                         word |= bit; });
+    auto filter = empty_filter(distinct);
+    for (std::size_t i = 0; i < seen.size(); ++i)
+    {
+        for (auto word = seen[i]; word != 0; word &= word - 1)
+        {
+            add_trigram(filter, static_cast<std::uint32_t>(i * 64 + static_cast<std::size_t>(std::countr_zero(word))));
+        }
+    }
+    return filter;
+}
+
+TextQuery::TextQuery(std::string_view query) : needle(query), trigrams(trigrams_of(query))
+{
+    std::ranges::transform(needle, needle.begin(), fold);
+}
+
+bool TextQuery::may_match(std::string_view filter) const
+{
+    if (trigrams.empty())
+    {
+        return true;
+    }
+    // Text without trigrams cannot contain a query with some.
+    if (filter.empty())
+    {
+        return false;
+    }
+    // Filters are a power of two bytes; anything else rules nothing out.
+    if (!std::has_single_bit(filter.size()))
+    {
+        return true;
+    }
+    const std::uint64_t bits = filter.size() * 8;
+    return std::ranges::all_of(trigrams, [&](std::uint32_t trigram)
+                               {
+                                   const auto h = probe_hash(trigram);
+                                   return test_bit(filter, h & (bits - 1)) && test_bit(filter, (h >> 32) & (bits - 1)); });
+}
+
+bool TextQuery::matches(std::string_view text) const
+{
+    if (needle.empty())
+    {
+        return true;
+    }
+    const std::boyer_moore_horspool_searcher searcher(
+        needle.begin(), needle.end(), [](char c)
+        { return std::hash<char>()(fold(c)); },
+        [](char a, char b)
+        { return fold(a) == fold(b); });
+    return std::search(text.begin(), text.end(), searcher) != text.end();
+}
+}
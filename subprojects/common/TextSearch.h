@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clipboard
+{
+// Substring search over the text of history entries. Each entry's summary
+// carries a Bloom filter of the trigrams in its text/plain payload, built
+// when the entry is captured, so a search only reads the text of entries
+// whose filter admits every trigram of the query. Matching ignores ASCII
+// case. Building a filter for a long text needs a fixed 2 MiB, not memory in
+// proportion to the text.
+
+// The filter for text; empty when text has no trigrams.
+std::string trigram_filter(std::string_view text);
+
+class TextQuery
+{
+public:
+    explicit TextQuery(std::string_view query);
+
+    // False when text with this filter cannot contain the query.
+    bool may_match(std::string_view filter) const;
+    bool matches(std::string_view text) const;
+
+private:
+    std::string needle;
+    std::vector<std::uint32_t> trigrams;
+};
+}
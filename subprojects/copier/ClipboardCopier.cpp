@@ -1,4 +1,5 @@
 #include "ClipboardCopier.h"
+#include "ControlSocket.h"
 #include "PosixIO.h"
 #include "StringUtils.h"
 #include <iostream>
@@ -6,14 +7,21 @@
 #include <cstring>
 #include <sys/wait.h>
 #include <algorithm>
+#include <cctype>
 #include <cerrno>
+#include <csignal>
 #include <fcntl.h>
-#include <format>
+#include <functional>
+#include <numeric>
 #include <poll.h>
+#include <sys/epoll.h>
 
 namespace
 {
 constexpr std::size_t max_picker_output_size = 1024 * 1024;
+// Options are produced about this many bytes at a time as the picker reads.
+constexpr std::size_t picker_write_chunk = 16 * 1024;
+constexpr std::chrono::milliseconds watcher_reply_timeout{500};
 
 bool set_nonblocking_or_log(int fd)
 {
@@ -25,7 +33,16 @@ bool set_nonblocking_or_log(int fd)
     return true;
 }
 
-bool run_picker_command(const std::string &command, const std::vector<std::string> &options, std::string &choice)
+// The picker's end of a dmenu-style pipeline: options go to its stdin and
+// the chosen line comes back on its stdout.
+struct PickerProcess
+{
+    pid_t pid = -1;
+    clipboard::UniqueFd to_child;
+    clipboard::UniqueFd from_child;
+};
+
+bool spawn_picker(const std::string &command, PickerProcess &picker)
 {
     int to_child_pipe[2] = {-1, -1};
     int from_child_pipe[2] = {-1, -1};
@@ -64,24 +81,57 @@ bool run_picker_command(const std::string &command, const std::vector<std::strin
         _exit(127);
     }
 
-    to_child_read.reset();
-    from_child_write.reset();
-
-    if (!set_nonblocking_or_log(to_child_write.get()) || !set_nonblocking_or_log(from_child_read.get()))
+    picker.pid = pid;
+    picker.to_child = std::move(to_child_write);
+    picker.from_child = std::move(from_child_read);
+    if (!set_nonblocking_or_log(picker.to_child.get()) || !set_nonblocking_or_log(picker.from_child.get()))
     {
+        picker.to_child.reset();
+        picker.from_child.reset();
         int status = 0;
         waitpid(pid, &status, 0);
         return false;
     }
+    return true;
+}
 
-    std::string input;
-    for (const auto &option : options)
-    {
-        input += option;
-        input += '\n';
+// Pickers may trim or collapse whitespace in the line they print back.
+bool same_ignoring_whitespace(std::string_view a, std::string_view b)
+{
+    const auto is_space = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+    auto a_it = a.begin();
+    auto b_it = b.begin();
+    while (true)
+    {
+        a_it = std::find_if_not(a_it, a.end(), is_space);
+        b_it = std::find_if_not(b_it, b.end(), is_space);
+        if (a_it == a.end() || b_it == b.end())
+        {
+            return a_it == a.end() && b_it == b.end();
+        }
+        if (*a_it++ != *b_it++)
+        {
+            return false;
+        }
     }
+}
+
+// Fills row with the next option, without its newline. Returns false once
+// there are no more.
+using OptionSource = std::function<bool(std::string &row)>;
+
+// Streams options to a running picker as it accepts them and collects its
+// output until it exits. Rows are produced only when the pipe has room, so
+// the picker can show the first ones before the rest exist.
+bool run_picker(PickerProcess &picker, const OptionSource &next_option, std::string &choice)
+{
+    clipboard::UniqueFd &to_child_write = picker.to_child;
+    clipboard::UniqueFd &from_child_read = picker.from_child;
 
+    std::string input;
+    std::string row;
     std::size_t input_offset = 0;
+    bool options_done = false;
     bool read_open = true;
     char buffer[1024];
 
@@ -107,23 +157,44 @@ bool run_picker_command(const std::string &command, const std::vector<std::strin
             to_child_write.reset();
         }
 
-        if (to_child_write.valid() && (fds[1].revents & POLLOUT))
+        while (to_child_write.valid() && (fds[1].revents & POLLOUT))
         {
-            const char *data = input.data() + input_offset;
-            const std::size_t remaining = input.size() - input_offset;
-            ssize_t n = remaining == 0 ? 0 : write(to_child_write.get(), data, remaining);
+            if (input_offset == input.size())
+            {
+                input.clear();
+                input_offset = 0;
+                while (!options_done && input.size() < picker_write_chunk)
+                {
+                    if (!next_option(row))
+                    {
+                        options_done = true;
+                        break;
+                    }
+                    input += row;
+                    input += '\n';
+                }
+                if (input.empty())
+                {
+                    to_child_write.reset();
+                    break;
+                }
+            }
+
+            ssize_t n = write(to_child_write.get(), input.data() + input_offset, input.size() - input_offset);
             if (n > 0)
             {
                 input_offset += static_cast<std::size_t>(n);
+                continue;
             }
-            else if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+            if (n < 0 && errno == EINTR)
             {
-                to_child_write.reset();
+                continue;
             }
-            if (input_offset == input.size())
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
             {
                 to_child_write.reset();
             }
+            break;
         }
 
         if (read_open && (fds[0].revents & (POLLERR | POLLNVAL)))
@@ -171,7 +242,7 @@ bool run_picker_command(const std::string &command, const std::vector<std::strin
     from_child_read.reset();
 
     int status = 0;
-    if (waitpid(pid, &status, 0) < 0)
+    if (waitpid(picker.pid, &status, 0) < 0)
     {
         perror("waitpid");
         return false;
@@ -185,90 +256,169 @@ bool run_picker_command(const std::string &command, const std::vector<std::strin
     clipboard::trim(choice);
     return true;
 }
-
-std::string picker_label(std::size_t index, const clipboard::ClipboardEntry &entry)
-{
-    const auto text = entry.find("text/plain");
-    if (text != entry.end())
-    {
-        auto preview = clipboard::single_line_preview(text->second);
-        if (!preview.empty())
-        {
-            return std::format("{}: {}", index + 1, preview);
-        }
-    }
-    if (!entry.empty())
-    {
-        return std::format("{}: Non-text Clipboard Entry ({})", index + 1, entry.begin()->first);
-    }
-    return std::format("{}: Non-text Clipboard Entry", index + 1);
-}
 }
 
-ClipboardCopier::ClipboardCopier(const std::string &command)
+ClipboardCopier::ClipboardCopier(const std::string &command, CopierOptions options) : options(std::move(options))
 {
-    load_clipboard_data();
     choose_clipboard_data(command);
 }
 
-bool ClipboardCopier::choose_clipboard_data(const std::string &command)
+std::vector<std::size_t> ClipboardCopier::candidate_entries() const
 {
-    if (clipboard_history.empty())
+    if (!options.search_query.empty())
     {
-        std::cerr << "Clipboard history is empty" << std::endl;
-        return false;
+        return clipboard_history.search(options.search_query);
     }
+    std::vector<std::size_t> all(clipboard_history.size());
+    std::iota(all.begin(), all.end(), std::size_t{0});
+    return all;
+}
 
+bool ClipboardCopier::choose_clipboard_data(const std::string &command)
+{
     if (command == "")
     {
-        clipboard_data = clipboard_history.front();
+        load_clipboard_data();
+        if (clipboard_history.empty())
+        {
+            std::cerr << "Clipboard history is empty" << std::endl;
+            return false;
+        }
+        const auto candidates = candidate_entries();
+        if (candidates.empty())
+        {
+            std::cerr << "No clipboard history entry contains \"" << options.search_query << "\"" << std::endl;
+            return false;
+        }
+        std::optional<std::size_t> index = candidates.front();
+        if (!options.match_query.empty())
+        {
+            // Ranked in process: no shell, picker or pipes.
+            index = clipboard_history.best_fuzzy_match(candidates, options.match_query);
+            if (!index)
+            {
+                std::cerr << "No clipboard history entry matches \"" << options.match_query << "\"" << std::endl;
+                return false;
+            }
+        }
+        clipboard_index = *index;
+        clipboard_data = clipboard_history[clipboard_index];
         return !clipboard_data.empty();
     }
 
-    clipboard_data.clear();
-    std::vector<std::string> options;
-    std::vector<std::size_t> option_indexes;
-    for (std::size_t i = 0; i < clipboard_history.size(); ++i)
+    // Without a history there is nothing to offer, so say so instead of
+    // showing an empty menu.
+    if (!clipboard::HistoryView::may_have_entries(options.history_file))
     {
-        const auto &entry = clipboard_history[i];
-        if (!entry.empty())
-        {
-            options.push_back(picker_label(i, entry));
-            option_indexes.push_back(i);
-        }
+        std::cerr << "Clipboard history is empty" << std::endl;
+        return false;
     }
 
-    if (options.empty())
+    // Start the picker before reading the history so its window comes up
+    // while the options are still being produced.
+    PickerProcess picker;
+    if (!spawn_picker(command, picker))
     {
-        std::cerr << "Clipboard history has no selectable entries" << std::endl;
         return false;
     }
+    load_clipboard_data();
+
+    // Searching keeps each entry's history position in its label, so the
+    // choice resolves the same way.
+    const auto candidates = candidate_entries();
+
+    clipboard_data = {};
+    std::size_t option_count = 0;
+    std::size_t next_entry = 0;
+    const auto next_option = [&](std::string &row)
+    {
+        while (next_entry < candidates.size())
+        {
+            const auto index = candidates[next_entry++];
+            const auto &entry = clipboard_history[index];
+            if (!entry.empty())
+            {
+                row = clipboard::picker_label(index, entry, options.label_separator);
+                ++option_count;
+                return true;
+            }
+        }
+        return false;
+    };
 
     std::string choice;
-    if (!run_picker_command(command, options, choice))
+    const bool picked = run_picker(picker, next_option, choice);
+    if (clipboard_history.empty())
     {
+        std::cerr << "Clipboard history is empty" << std::endl;
         return false;
     }
-
-    for (std::size_t i = 0; i < options.size(); ++i)
+    if (option_count == 0 && next_entry == candidates.size())
     {
-        if (choice == options[i])
+        if (!options.search_query.empty())
+        {
+            std::cerr << "No clipboard history entry contains \"" << options.search_query << "\"" << std::endl;
+        }
+        else
         {
-            clipboard_data = clipboard_history[option_indexes[i]];
-            return true;
+            std::cerr << "Clipboard history has no selectable entries" << std::endl;
         }
+        return false;
+    }
+    if (!picked)
+    {
+        return false;
+    }
+
+    // The label starts with the entry's position, so only that slot needs
+    // checking.
+    const auto &separator = options.label_separator;
+    const auto index = clipboard::picker_label_index(choice, separator);
+    if (index && *index < clipboard_history.size() && !clipboard_history[*index].empty() &&
+        same_ignoring_whitespace(choice, clipboard::picker_label(*index, clipboard_history[*index], separator)))
+    {
+        clipboard_data = clipboard_history[*index];
+        clipboard_index = *index;
+        return true;
     }
 
     std::cerr << "Picker selection did not match clipboard history" << std::endl;
     return false;
 }
 
+bool ClipboardCopier::restore_through_watcher() const
+{
+    // A running watcher already holds the history and a Wayland connection,
+    // so it can own the selection instead of a forked copier.
+    const auto path = clipboard::control_socket_path();
+    if (path.empty() || options.history_file != clipboard::history_path())
+    {
+        return false;
+    }
+    const auto reply = clipboard::send_control_request(
+        path, clipboard::encode_select_request(clipboard_index, clipboard_data.hash), watcher_reply_timeout);
+    if (!reply)
+    {
+        return false;
+    }
+    if (*reply != "ok")
+    {
+        std::cerr << "Watcher could not restore the entry: " << *reply << std::endl;
+        return false;
+    }
+    return true;
+}
+
 int ClipboardCopier::run()
 {
     if (clipboard_data.empty())
     {
         return 1;
     }
+    if (restore_through_watcher())
+    {
+        return 0;
+    }
     if (!init())
     {
         cleanup();
@@ -288,9 +438,51 @@ int ClipboardCopier::run()
         return 0; // Exit parent process
     }
 
-    while (running && wl_display_dispatch(display) != -1)
+    // A paste target that closes its end early must not kill the copier.
+    signal(SIGPIPE, SIG_IGN);
+    while (running)
+    {
+        while (wl_display_prepare_read(display) != 0)
+        {
+            if (wl_display_dispatch_pending(display) < 0)
+            {
+                running = false;
+                break;
+            }
+        }
+        if (!running)
+        {
+            break;
+        }
+        if (wl_display_flush(display) < 0)
+        {
+            wl_display_cancel_read(display);
+            break;
+        }
+
+        // Paste transfers progress here; the Wayland fd handler only records
+        // readiness so events are read below.
+        wayland_readable = false;
+        if (!loop.run_once())
+        {
+            wl_display_cancel_read(display);
+            break;
+        }
+        if (!wayland_readable)
+        {
+            wl_display_cancel_read(display);
+            continue;
+        }
+        if (wl_display_read_events(display) < 0 || wl_display_dispatch_pending(display) < 0)
+        {
+            break;
+        }
+    }
+
+    // Another client owns the selection now, but pastes already requested
+    // from this one still get their data.
+    while (!sender.empty() && loop.run_once())
     {
-        // Keep dispatching events
     }
 
     cleanup();
@@ -333,9 +525,9 @@ bool ClipboardCopier::init()
         return false;
     }
     zwlr_data_control_source_v1_add_listener(data_source, &data_source_listener, this);
-    for (const auto &entry : clipboard_data)
+    for (const auto &[mime, payload] : clipboard_data.payloads)
     {
-        zwlr_data_control_source_v1_offer(data_source, entry.first.c_str());
+        zwlr_data_control_source_v1_offer(data_source, clipboard::mime_name(mime).c_str());
     }
     zwlr_data_control_device_v1_set_selection(data_control_device, data_source);
     if (wl_display_flush(display) < 0)
@@ -344,11 +536,17 @@ bool ClipboardCopier::init()
         return false;
     }
 
-    return true;
+    if (!loop.initialize())
+    {
+        return false;
+    }
+    return loop.add(wl_display_get_fd(display), EPOLLIN, [this](std::uint32_t)
+                    { wayland_readable = true; });
 }
 
 void ClipboardCopier::cleanup()
 {
+    sender.clear();
     if (data_source)
     {
         zwlr_data_control_source_v1_destroy(data_source);
@@ -400,16 +598,9 @@ void ClipboardCopier::data_source_send_s(void *data, struct zwlr_data_control_so
 {
     clipboard::UniqueFd output(fd);
     ClipboardCopier *self = static_cast<ClipboardCopier *>(data);
-    for (const auto &entry : self->clipboard_data)
+    if (const auto *payload = self->clipboard_data.payload(mime))
     {
-        if (strcmp(entry.first.c_str(), mime) == 0)
-        {
-            if (!clipboard::write_all(output.get(), entry.second))
-            {
-                std::cerr << "Failed to write to fd" << std::endl;
-            }
-            break;
-        }
+        self->sender.send(std::move(output), payload->data(), nullptr, payload->is_mapped());
     }
 }
 
@@ -432,5 +623,5 @@ const struct zwlr_data_control_source_v1_listener ClipboardCopier::data_source_l
 
 void ClipboardCopier::load_clipboard_data()
 {
-    clipboard_history = clipboard::load_history();
+    clipboard_history.open(options.history_file);
 }
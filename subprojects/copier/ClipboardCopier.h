@@ -1,16 +1,33 @@
 #pragma once
 
+#include <filesystem>
 #include <string>
 #include <wayland-client.h>
 #include "wlr-data-control-unstable-v1-client-protocol.h"
 #include <vector>
 #include <map>
 #include "ClipboardHistory.h"
+#include "EventLoop.h"
+#include "HistoryView.h"
+#include "PayloadSender.h"
+
+struct CopierOptions
+{
+    std::string label_separator = std::string(clipboard::default_label_separator);
+    // Entries from a history other than the watcher's clipboard history are
+    // always served by the copier itself.
+    std::filesystem::path history_file = clipboard::history_path();
+    // When set, only entries whose text contains it are offered.
+    std::string search_query;
+    // When set, the entry that best matches it as a fuzzy pattern is chosen
+    // without running a picker.
+    std::string match_query;
+};
 
 class ClipboardCopier
 {
 public:
-    ClipboardCopier(const std::string &command);
+    explicit ClipboardCopier(const std::string &command, CopierOptions options = {});
     int run();
 
 private:
@@ -25,6 +42,9 @@ private:
 
     void load_clipboard_data();
     bool choose_clipboard_data(const std::string &command);
+    // History indexes the options allow, newest first.
+    std::vector<std::size_t> candidate_entries() const;
+    bool restore_through_watcher() const;
 
     // Wayland objects
     wl_display *display = nullptr;
@@ -35,9 +55,15 @@ private:
     zwlr_data_control_device_v1 *data_control_device = nullptr;
 
     // State
+    CopierOptions options;
     bool running = true;
-    clipboard::ClipboardEntry clipboard_data;
-    clipboard::ClipboardHistory clipboard_history;
+    bool wayland_readable = false;
+    clipboard::EntryView clipboard_data;
+    std::size_t clipboard_index = 0;
+    clipboard::HistoryView clipboard_history;
+    clipboard::EventLoop loop;
+    // Payload views point into clipboard_history's mappings.
+    clipboard::PayloadSender sender{loop};
 
     // Listener structs
     static const struct wl_registry_listener registry_listener;
@@ -1,10 +1,64 @@
 #include "ClipboardCopier.h"
 #include <iostream>
+#include <string_view>
+
+namespace
+{
+int usage(const char *program)
+{
+    std::cerr << "Usage: " << program
+              << " [--primary] [--label-separator SEP] [--search QUERY] [--match QUERY | PICKER COMMAND...]"
+              << std::endl;
+    return 1;
+}
+}
 
 int main(int argc, char *argv[])
 {
+    CopierOptions options;
+    int first = 1;
+    while (first < argc)
+    {
+        const std::string_view option = argv[first];
+        if (option == "--primary")
+        {
+            options.history_file = clipboard::primary_history_path();
+            first += 1;
+        }
+        else if (option == "--label-separator" || option == "--search" || option == "--match")
+        {
+            if (first + 1 >= argc || argv[first + 1][0] == '\0')
+            {
+                return usage(argv[0]);
+            }
+            if (option == "--search")
+            {
+                options.search_query = argv[first + 1];
+            }
+            else if (option == "--match")
+            {
+                options.match_query = argv[first + 1];
+            }
+            else
+            {
+                options.label_separator = argv[first + 1];
+            }
+            first += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // --match chooses the entry itself.
+    if (!options.match_query.empty() && first < argc)
+    {
+        return usage(argv[0]);
+    }
+
     std::string command;
-    for (int i = 1; i < argc; ++i)
+    for (int i = first; i < argc; ++i)
     {
         command += argv[i];
         if (i < argc - 1)
@@ -12,6 +66,6 @@ int main(int argc, char *argv[])
             command += " ";
         }
     }
-    ClipboardCopier copier(command);
+    ClipboardCopier copier(command, std::move(options));
     return copier.run();
 }
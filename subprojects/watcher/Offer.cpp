@@ -1,22 +1,21 @@
 #include "Offer.h"
 
-void Offer::add_mime_type(const std::string &mime_type)
+void Offer::add_mime_type(std::string_view mime_type)
 {
-    mime_types.push(mime_type);
+    if (mime_type == HISTORY_RESTORE_MIME)
+    {
+        restore = true;
+        return;
+    }
+    mime_types.push_back(clipboard::intern_mime(mime_type));
 }
 
-std::string Offer::pop_mime_type()
+clipboard::MimeId Offer::pop_mime_type()
 {
-    if (mime_types.empty())
-    {
-        return std::string();
-    }
-    std::string mime_type = mime_types.front();
-    mime_types.pop();
-    return mime_type;
+    return mime_types.at(next_mime_type++);
 }
 
-void Offer::receive_mime(const std::string &mime_type, int fd)
+void Offer::receive_mime(clipboard::MimeId mime_type, int fd)
 {
-    zwlr_data_control_offer_v1_receive(offer, mime_type.c_str(), fd);
+    zwlr_data_control_offer_v1_receive(offer, clipboard::mime_name(mime_type).c_str(), fd);
 }
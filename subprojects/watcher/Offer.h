@@ -1,9 +1,12 @@
 #pragma once
 #include <wlr-data-control-unstable-v1-client-protocol.h>
-#include <string>
-#include <queue>
-#include <list>
-#include <map>
+#include "MimeType.h"
+#include <string_view>
+#include <vector>
+
+// Offered alongside history entries the watcher restores itself, so it can
+// recognise its own selection instead of reading it back.
+inline constexpr const char *HISTORY_RESTORE_MIME = "application/x-wl-copy-slurp-restore";
 
 class Offer
 {
@@ -16,13 +19,18 @@ public:
     Offer(Offer &&) = delete;
     Offer &operator=(Offer &&) = delete;
 
-    void add_mime_type(const std::string &mime_type);
+    void add_mime_type(std::string_view mime_type);
     bool matches(zwlr_data_control_offer_v1 *other_offer) const { return offer == other_offer; }
-    bool has_mime_types() const { return !mime_types.empty(); }
-    std::string pop_mime_type();
-    void receive_mime(const std::string &mime_type, int fd);
+    bool has_mime_types() const { return next_mime_type < mime_types.size(); }
+    bool is_restore() const { return restore; }
+    clipboard::MimeId pop_mime_type();
+    // Gives up on the MIME types not read yet.
+    void skip_mime_types() { next_mime_type = mime_types.size(); }
+    void receive_mime(clipboard::MimeId mime_type, int fd);
 
 private:
-    std::queue<std::string> mime_types = std::queue<std::string>();
+    std::vector<clipboard::MimeId> mime_types;
+    std::size_t next_mime_type = 0;
     zwlr_data_control_offer_v1 *offer = nullptr;
+    bool restore = false;
 };
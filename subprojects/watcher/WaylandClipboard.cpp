@@ -1,22 +1,24 @@
 #include "WaylandClipboard.h"
+#include "ContentHash.h"
 #include "PosixIO.h"
 #include <unistd.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <csignal>
+#include <sys/epoll.h>
 #include <iostream>
 #include <cerrno>
 #include <algorithm>
+#include <utility>
 
 // Constants
 static constexpr size_t BUFFER_SIZE = 4096;
-static constexpr int POLL_FD_COUNT = 2;
-static constexpr int POLL_TIMEOUT_IDLE = 500;
-static constexpr int POLL_TIMEOUT_EXPECTING = 1000;
+static constexpr size_t MAX_CONCURRENT_MIME_READS = 8;
+static constexpr std::chrono::milliseconds MIME_READ_IDLE_TIMEOUT{1000};
 static constexpr int READ_FD_INDEX = 0;
 static constexpr int WRITE_FD_INDEX = 1;
-static constexpr int WAYLAND_FD_INDEX = 0;
-static constexpr int PIPE_FD_INDEX = 1;
-static constexpr size_t MAX_MIME_CONTENT_SIZE = 1024 * 1024;
+static constexpr size_t MAX_MIME_CONTENT_SIZE = 256 * 1024 * 1024;
+// Payloads larger than this are streamed to a blob file instead of memory.
+static constexpr size_t SPILL_THRESHOLD = 256 * 1024;
 
 WaylandClipboard::~WaylandClipboard()
 {
@@ -25,11 +27,22 @@ WaylandClipboard::~WaylandClipboard()
 
 bool WaylandClipboard::initialize()
 {
+    // Block SIGINT and SIGTERM before the history writer threads start, so
+    // they inherit the mask and the signals reach the event loop.
+    if (!signals.create({SIGINT, SIGTERM}))
+    {
+        return false;
+    }
     load_clipboard_data();
 
     // Register callbacks
     connection.set_offer_ready_callback([this](std::shared_ptr<Offer> offer)
-                                        { this->handle_selection(offer); });
+                                        { this->handle_selection(selection, offer); });
+    if (capture_primary)
+    {
+        connection.set_primary_offer_callback([this](std::shared_ptr<Offer> offer)
+                                              { this->handle_selection(primary, offer); });
+    }
     if (!connection.initialize())
     {
         return false;
@@ -40,109 +53,369 @@ bool WaylandClipboard::initialize()
         return false;
     }
 
-    return true;
+    return setup_event_loop();
 }
 
-int WaylandClipboard::run()
+bool WaylandClipboard::setup_event_loop()
 {
-    wl_display_flush(connection.get_display());
+    if (!loop.initialize() || !read_timer.create())
+    {
+        return false;
+    }
+    for (auto *capture : {&selection, &primary})
+    {
+        if (!capture->settle_timer.create() ||
+            !loop.add(capture->settle_timer.get(), EPOLLIN, [this, capture](std::uint32_t)
+                      { capture->settle_timer.consume(); start_settled_capture(*capture); }))
+        {
+            return false;
+        }
+    }
 
-    struct pollfd fds[POLL_FD_COUNT];
-    setup_polling(fds);
+    return loop.add(wl_display_get_fd(connection.get_display()), EPOLLIN, [this](std::uint32_t)
+                    { wayland_readable = true; }) &&
+           loop.add(read_timer.get(), EPOLLIN, [this](std::uint32_t)
+                    { read_timer.consume(); expire_mime_reads(); }) &&
+           loop.add(blob_committer.get(), EPOLLIN, [this](std::uint32_t)
+                    { blob_committer.run_callbacks(); }) &&
+           loop.add(signals.get(), EPOLLIN, [this](std::uint32_t)
+                    {
+                        while (int signal = signals.consume())
+                        {
+                            std::cerr << "Received signal " << signal << ", exiting" << std::endl;
+                            stop_requested = true;
+                        } }) &&
+           start_control_socket() && start_metrics_timer();
+}
 
-    bool waited = false;
+bool WaylandClipboard::start_control_socket()
+{
+    // Without the socket wl-copy-picker falls back to owning the selection
+    // itself, so failing to listen is not fatal.
+    const auto path = clipboard::control_socket_path();
+    if (path.empty())
+    {
+        std::cerr << "XDG_RUNTIME_DIR is unset, control socket disabled" << std::endl;
+        return true;
+    }
+    if (!control.listen(path, [this](std::string_view request)
+                        { return handle_control_request(request); }))
+    {
+        std::cerr << "Control socket disabled" << std::endl;
+    }
+    return true;
+}
+
+bool WaylandClipboard::start_metrics_timer()
+{
+    if (metrics_file.empty())
+    {
+        return true;
+    }
+    write_metrics();
+    return metrics_timer.create() && metrics_timer.arm(metrics_interval, metrics_interval) &&
+           loop.add(metrics_timer.get(), EPOLLIN, [this](std::uint32_t)
+                    { metrics_timer.consume(); write_metrics(); });
+}
 
-    while (connection.is_running())
+void WaylandClipboard::write_metrics() const
+{
+    clipboard::write_metrics_file(metrics_file, render_metrics());
+}
+
+std::string WaylandClipboard::render_metrics() const
+{
+    std::vector<std::pair<std::string_view, const Capture *>> captures = {{"clipboard", &selection}};
+    if (capture_primary)
     {
-        try
+        captures.emplace_back("primary", &primary);
+    }
+    clipboard::MetricsText text;
+    const auto counter = [&](std::string_view name, std::string_view help, auto value)
+    {
+        text.family(name, "counter", help);
+        for (const auto &[label, capture] : captures)
+        {
+            text.sample(name, value(*capture), {{"selection", label}});
+        }
+    };
+    const auto histogram = [&](std::string_view name, std::string_view help, auto histogram)
+    {
+        text.family(name, "histogram", help);
+        for (const auto &[label, capture] : captures)
         {
-            // If wayland events are ready then poll was not because of clipboard data
-            if (handle_wayland_events(fds))
+            if (const auto *latencies = histogram(*capture))
             {
-                continue;
+                text.histogram(name, *latencies, {{"selection", label}});
             }
         }
-        catch (const std::exception &e)
+    };
+
+    counter("wl_copy_slurp_offers_total", "Selection offers received.", [](const Capture &c)
+            { return c.metrics.offers; });
+    counter("wl_copy_slurp_offers_coalesced_total", "Offers replaced by a newer one before they were stored.",
+            [](const Capture &c)
+            { return c.coalesced_offers; });
+    counter("wl_copy_slurp_mime_reads_started_total", "MIME type reads started.", [](const Capture &c)
+            { return c.metrics.reads_started; });
+    counter("wl_copy_slurp_mime_reads_finished_total", "MIME type reads that reached their end.", [](const Capture &c)
+            { return c.metrics.reads_finished; });
+    counter("wl_copy_slurp_mime_reads_truncated_total", "MIME type reads cut off at the payload size limit.",
+            [](const Capture &c)
+            { return c.metrics.reads_truncated; });
+    counter("wl_copy_slurp_mime_reads_cancelled_total", "MIME type reads abandoned for a newer offer.",
+            [](const Capture &c)
+            { return c.metrics.reads_cancelled; });
+    counter("wl_copy_slurp_mime_reads_stalled_total", "MIME type reads abandoned at a read deadline.",
+            [](const Capture &c)
+            { return c.metrics.reads_stalled; });
+    counter("wl_copy_slurp_blob_commits_failed_total", "Large payloads that could not be stored as blob files.",
+            [](const Capture &c)
+            { return c.metrics.blob_commits_failed; });
+    counter("wl_copy_slurp_offers_timed_out_total", "Offers stored with what was read by the offer deadline.",
+            [](const Capture &c)
+            { return c.metrics.offers_timed_out; });
+    counter("wl_copy_slurp_entries_stored_total", "New entries added to history.", [](const Capture &c)
+            { return c.metrics.entries_stored; });
+    counter("wl_copy_slurp_duplicate_entries_total", "Captures already in history, moved to the front instead.",
+            [](const Capture &c)
+            { return c.metrics.duplicates; });
+
+    text.family("wl_copy_slurp_captured_bytes_total", "counter", "Payload bytes read, by MIME type.");
+    for (const auto &[label, capture] : captures)
+    {
+        for (const auto &[mime, bytes] : capture->metrics.captured_bytes)
         {
-            std::cerr << e.what() << std::endl;
-            return 1;
+            text.sample("wl_copy_slurp_captured_bytes_total", bytes,
+                        {{"selection", label}, {"mime", clipboard::mime_name(mime)}});
         }
+    }
+
+    text.family("wl_copy_slurp_history_entries", "gauge", "Entries in history.");
+    for (const auto &[label, capture] : captures)
+    {
+        text.sample("wl_copy_slurp_history_entries", capture->history.size(), {{"selection", label}});
+    }
+    counter("wl_copy_slurp_history_writes_coalesced_total", "History writes batched with an earlier one.",
+            [](const Capture &c)
+            { return c.log.coalesced_writes(); });
+
+    histogram("wl_copy_slurp_capture_seconds", "Time from a selection offer to its capture, settle time included.",
+              [](const Capture &c)
+              { return &c.metrics.capture_latency; });
+    histogram("wl_copy_slurp_history_write_seconds", "Time to write one batch of history records.",
+              [](const Capture &c)
+              {
+                  const auto *writer = c.log.background_writer();
+                  return writer ? &writer->write_latency() : nullptr;
+              });
+    histogram("wl_copy_slurp_history_sync_seconds", "Time spent in fdatasync after appending history records.",
+              [](const Capture &c)
+              {
+                  const auto *writer = c.log.background_writer();
+                  return writer ? &writer->sync_latency() : nullptr;
+              });
+    return text.str();
+}
+
+int WaylandClipboard::run()
+{
+    wl_display *display = connection.get_display();
+    wl_event_queue *queue = connection.get_event_queue();
 
-        if (offer && read_fd >= 0)
+    while (connection.is_running() && !stop_requested)
+    {
+        while (wl_display_prepare_read_queue(display, queue) != 0)
         {
-            if (waited || (fds[PIPE_FD_INDEX].revents & POLLIN))
-            {
-                process_clipboard_data(fds[PIPE_FD_INDEX].revents & POLLIN);
-            }
-            if (read_fd >= 0 && !(fds[PIPE_FD_INDEX].revents & POLLIN))
-            {
-                waited = true;
-            }
-            else
+            if (wl_display_dispatch_queue_pending(display, queue) < 0)
             {
-                waited = false;
+                std::cerr << "Failed to dispatch Wayland events" << std::endl;
+                return 1;
             }
         }
 
-        if (wl_display_flush(connection.get_display()) < 0)
+        if (wl_display_flush(display) < 0)
         {
+            wl_display_cancel_read(display);
             std::cerr << "Failed to flush Wayland display" << std::endl;
             return 1;
         }
+
+        // Handlers for pipes, timers and signals run here; the Wayland fd
+        // handler only records readiness so events are read below.
+        wayland_readable = false;
+        if (!loop.run_once())
+        {
+            wl_display_cancel_read(display);
+            return 1;
+        }
+
+        if (!wayland_readable)
+        {
+            wl_display_cancel_read(display);
+            continue;
+        }
+        if (wl_display_read_events(display) < 0 || wl_display_dispatch_queue_pending(display, queue) < 0)
+        {
+            std::cerr << "Failed to read Wayland events" << std::endl;
+            return 1;
+        }
     }
 
     return 0;
 }
 
-void WaylandClipboard::setup_polling(struct pollfd fds[POLL_FD_COUNT])
+void WaylandClipboard::handle_mime_read_event(Capture &capture, int fd)
+{
+    auto read = std::ranges::find_if(capture.mime_reads, [fd](const MimeRead &r)
+                                     { return r.fd.get() == fd; });
+    if (read == capture.mime_reads.end())
+    {
+        return;
+    }
+    read->finished = drain_mime_read(capture, *read, true);
+    read->progress.last_data = capture.last_progress = std::chrono::steady_clock::now();
+    collect_finished_mime_reads(capture);
+}
+
+std::chrono::steady_clock::time_point WaylandClipboard::read_deadline(const Capture &capture, const MimeRead &read)
 {
-    fds[WAYLAND_FD_INDEX].fd = wl_display_get_fd(connection.get_display());
-    fds[WAYLAND_FD_INDEX].events = POLLIN;
-    fds[PIPE_FD_INDEX].fd = read_fd;
-    fds[PIPE_FD_INDEX].events = POLLIN;
-    fds[PIPE_FD_INDEX].revents = 0;
+    return clipboard::mime_read_deadline(read.progress, capture.last_progress, MIME_READ_IDLE_TIMEOUT,
+                                         capture.read_timeout, capture.offer_deadline);
 }
 
-bool WaylandClipboard::handle_wayland_events(struct pollfd fds[POLL_FD_COUNT])
+void WaylandClipboard::expire_mime_reads()
 {
-    while (wl_display_prepare_read_queue(connection.get_display(), connection.get_event_queue()) != 0)
+    // Sources that go silent, or keep a read or the whole offer open past
+    // its deadline, are abandoned with whatever they wrote so far, so one
+    // misbehaving client cannot hold up the selections after it.
+    const auto now = std::chrono::steady_clock::now();
+    for (auto *capture : {&selection, &primary})
     {
-        wl_display_dispatch_queue(connection.get_display(), connection.get_event_queue());
+        if (capture->offer && now >= capture->offer_deadline)
+        {
+            std::cerr << "Offer not read within " << capture->offer_timeout.count() << " ms, keeping what was read"
+                      << std::endl;
+            ++capture->metrics.offers_timed_out;
+            capture->partial = capture->partial || capture->offer->has_mime_types();
+            capture->offer->skip_mime_types();
+        }
+        for (auto &read : capture->mime_reads)
+        {
+            if (now < read_deadline(*capture, read))
+            {
+                continue;
+            }
+            read.finished = true;
+            if (!drain_mime_read(*capture, read, true))
+            {
+                std::cerr << "Abandoning stalled " << clipboard::mime_name(read.mime) << " read after "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(now - read.progress.started_at).count()
+                          << " ms" << std::endl;
+                read.stalled = true;
+                ++capture->metrics.reads_stalled;
+            }
+        }
+        collect_finished_mime_reads(*capture);
     }
+    update_read_timer();
+}
 
-    setup_polling(fds);
-    int timeout = (read_fd >= 0) ? POLL_TIMEOUT_EXPECTING : POLL_TIMEOUT_IDLE;
-    int ret = poll(fds, POLL_FD_COUNT, timeout);
-    if (ret < 0)
+void WaylandClipboard::collect_finished_mime_reads(Capture &capture)
+{
+    for (auto &read : capture.mime_reads)
     {
-        perror("poll");
-        throw std::runtime_error("Failed to poll Wayland events");
+        if (read.finished)
+        {
+            loop.remove(read.fd.get());
+            ++capture.metrics.reads_finished;
+            capture.partial = capture.partial || read.stalled || read.truncated;
+            capture.metrics.captured_bytes[read.mime] += read.blob.is_open() ? read.blob.size() : read.content.size();
+            if (!read.blob.is_open())
+            {
+                capture.pending_entry.insert_or_assign(read.mime, std::move(read.content));
+                continue;
+            }
+            // Syncing and renaming a blob of up to MAX_MIME_CONTENT_SIZE
+            // bytes, or summarizing it as text, would stall every other
+            // client of the loop.
+            ++capture.pending_commits;
+            blob_committer.commit(std::move(read.blob), read.mime == clipboard::text_plain_mime,
+                                  [this, &capture, serial = capture.reads_serial, mime = read.mime](
+                                      clipboard::BlobCommitter::Result result)
+                                  { handle_blob_commit(capture, serial, mime, std::move(result)); });
+        }
     }
+    std::erase_if(capture.mime_reads, [](const MimeRead &read)
+                  { return read.finished; });
 
-    if (fds[WAYLAND_FD_INDEX].revents & POLLIN)
+    start_mime_reads(capture);
+    complete_offer_if_read(capture);
+}
+
+void WaylandClipboard::handle_blob_commit(Capture &capture, std::uint64_t serial, clipboard::MimeId mime,
+                                          clipboard::BlobCommitter::Result result)
+{
+    if (serial != capture.reads_serial)
     {
-        if (wl_display_read_events(connection.get_display()) < 0 ||
-            wl_display_dispatch_queue(connection.get_display(), connection.get_event_queue()) < 0)
-        {
-            throw std::runtime_error("Failed to read Wayland events");
-        }
-        return true;
+        return;
+    }
+    --capture.pending_commits;
+    auto &payload = result.payload;
+    if (result.text_summary)
+    {
+        capture.text_summary = std::move(result.text_summary);
+    }
+    if (!payload || !payload->is_blob())
+    {
+        std::cerr << "Failed to store " << clipboard::mime_name(mime) << " blob, "
+                  << (payload ? "keeping it in memory" : "dropping it") << std::endl;
+        ++capture.metrics.blob_commits_failed;
+    }
+    if (payload)
+    {
+        capture.pending_entry.insert_or_assign(mime, std::move(*payload));
     }
     else
     {
-        wl_display_cancel_read(connection.get_display());
-        return false;
+        capture.partial = true;
+    }
+    complete_offer_if_read(capture);
+}
+
+void WaylandClipboard::complete_offer_if_read(Capture &capture)
+{
+    if (capture.offer && capture.mime_reads.empty() && capture.pending_commits == 0)
+    {
+        handle_offer_completion(capture);
     }
 }
 
-void WaylandClipboard::process_clipboard_data(bool has_pipe_data)
+bool WaylandClipboard::drain_mime_read(Capture &capture, MimeRead &read, bool has_pipe_data)
 {
     char buf[BUFFER_SIZE];
     bool saw_eof = !has_pipe_data;
 
-    while (read_fd >= 0)
+    while (true)
     {
-        ssize_t n = read(read_fd, buf, sizeof(buf));
+        const std::size_t stored = read.blob.is_open() ? read.blob.size() : read.content.size();
+        const std::size_t remaining = MAX_MIME_CONTENT_SIZE - std::min(stored, MAX_MIME_CONTENT_SIZE);
+        ssize_t n = 0;
+        if (read.blob.is_open() && read.can_splice && remaining > 0)
+        {
+            // Move pipe pages straight into the blob file.
+            n = read.blob.splice_from(read.fd.get(), remaining);
+            if (n < 0 && errno == EINVAL)
+            {
+                read.can_splice = false;
+                continue;
+            }
+        }
+        else
+        {
+            n = ::read(read.fd.get(), buf, sizeof(buf));
+        }
+
         if (n < 0)
         {
             if (errno == EINTR)
@@ -162,154 +435,429 @@ void WaylandClipboard::process_clipboard_data(bool has_pipe_data)
             saw_eof = true;
             break;
         }
-        const auto remaining = MAX_MIME_CONTENT_SIZE - current_content.size();
-        current_content.append(buf, std::min<std::size_t>(static_cast<std::size_t>(n), remaining));
-    }
-
-    if (saw_eof && offer && !current_mime.empty() && !clipboard_history.empty())
-    {
-        clipboard_history.front()[current_mime] = current_content;
-        finish_current_mime_read();
+        if (read.blob.is_open() && read.can_splice && remaining > 0)
+        {
+            continue;
+        }
 
-        if (offer->has_mime_types())
+        const auto size = std::min<std::size_t>(static_cast<std::size_t>(n), remaining);
+        if (size < static_cast<std::size_t>(n) && !read.truncated)
         {
-            start_next_mime_read();
+            std::cerr << "Truncating " << clipboard::mime_name(read.mime) << " payload at " << MAX_MIME_CONTENT_SIZE << " bytes" << std::endl;
+            read.truncated = true;
+            ++capture.metrics.reads_truncated;
         }
-        else
+        if (!store_mime_data(capture, read, {buf, size}))
         {
-            handle_offer_completion();
+            saw_eof = true;
+            break;
         }
     }
+
+    return saw_eof;
 }
 
-void WaylandClipboard::handle_offer_completion()
+bool WaylandClipboard::store_mime_data(const Capture &capture, MimeRead &read, std::string_view data)
 {
-    std::cout << "Offer completed, processing clipboard data" << std::endl;
-    offer.reset();
-    current_mime.clear();
-    current_content.clear();
-    if (clipboard_history.empty() || clipboard_history.front().empty())
+    if (read.blob.is_open())
     {
-        if (!clipboard_history.empty())
+        if (!read.blob.write(data))
         {
-            clipboard_history.erase(clipboard_history.begin());
+            read.blob.discard();
+            read.content.clear();
+            return false;
         }
+        return true;
+    }
+
+    const bool crosses_threshold = read.content.size() <= SPILL_THRESHOLD &&
+                                   read.content.size() + data.size() > SPILL_THRESHOLD;
+    read.content.append(data);
+    if (!crosses_threshold || capture.blob_dir.empty())
+    {
+        return true;
+    }
+    if (!read.blob.open(capture.blob_dir) || !read.blob.write(read.content))
+    {
+        // Keep the payload in memory if the blob directory is unusable.
+        read.blob.discard();
+        return true;
+    }
+    read.content.clear();
+    read.content.shrink_to_fit();
+    return true;
+}
+
+void WaylandClipboard::handle_offer_completion(Capture &capture)
+{
+    const auto latency = std::chrono::steady_clock::now() - capture.offered_at;
+    capture.metrics.capture_latency.observe(latency);
+    std::cout << "Offer completed after " << std::chrono::duration_cast<std::chrono::milliseconds>(latency).count()
+              << " ms, processing " << (&capture == &primary ? "primary selection" : "clipboard")
+              << " data (" << capture.coalesced_offers << " superseded offers coalesced so far)" << std::endl;
+    capture.offer.reset();
+    auto entry = std::move(capture.pending_entry);
+    capture.pending_entry.clear();
+    if (entry.empty())
+    {
         return;
     }
-    // Check if we already have this entry (important on startup)
-    if (clipboard_history.size() > 1)
+
+    auto digest = clipboard::digest_entry(entry, std::exchange(capture.text_summary, std::nullopt));
+    digest.summary.partial = std::exchange(capture.partial, false);
+    if (const auto index = capture.log.find(digest))
     {
-        const auto first = clipboard_history.front();
-        const auto second = clipboard_history[1];
-        for (const auto &[key, value] : second)
+        // Re-copying anything already in history moves it to the front.
+        if (*index == 0)
         {
-            if (copied)
-            {
-                if (first == second)
-                {
-                    // If the first and second entries are the same, we can skip this check
-                    std::cerr << "Skipping duplicate entry in clipboard history" << std::endl;
-                    clipboard_history.erase(clipboard_history.begin());
-                    break;
-                }
-            }
-            else
-            {
-                auto first_value = first.find(key);
-                if (value != "" && first_value != first.end() && first_value->second == value)
-                {
-                    clipboard_history.erase(clipboard_history.begin() + 1);
-                    break;
-                }
-            }
+            std::cerr << "Skipping duplicate entry in clipboard history" << std::endl;
+        }
+        else
+        {
+            capture.log.promote(capture.history, *index);
         }
-        copied = true; // Indicate that we have copied data
+        ++capture.metrics.duplicates;
+        capture.copied = true;
+        return;
     }
-    save_clipboard_data();
+
+    // On startup the current selection may be a variant of the newest entry:
+    // replace it if any non-empty payload matches.
+    if (!capture.copied && !capture.history.empty() && shares_payload(capture.log.digest(0), digest))
+    {
+        capture.log.erase(capture.history, 0);
+    }
+    capture.copied = true; // Indicate that we have copied data
+    capture.log.push_front(capture.history, std::move(entry), std::move(digest));
+    ++capture.metrics.entries_stored;
+}
+
+bool WaylandClipboard::shares_payload(const clipboard::EntryDigest &a, const clipboard::EntryDigest &b)
+{
+    static const auto empty_hash = clipboard::content_hash({});
+    return std::ranges::any_of(a.payloads, [&b](const auto &payload)
+                               { return payload.second != empty_hash && std::ranges::find(b.payloads, payload) != b.payloads.end(); });
 }
 
 void WaylandClipboard::load_clipboard_data()
 {
-    clipboard_history = clipboard::load_history();
+    selection.history = selection.log.open();
+    selection.log.write_in_background(durability_window);
+    if (const auto path = clipboard::history_path(); !path.empty())
+    {
+        selection.blob_dir = clipboard::blob_directory(path);
+    }
+    if (!capture_primary)
+    {
+        return;
+    }
+    primary.history = primary.log.open();
+    primary.log.write_in_background(durability_window);
+    if (const auto path = clipboard::primary_history_path(); !path.empty())
+    {
+        primary.blob_dir = clipboard::blob_directory(path);
+    }
 }
 
-void WaylandClipboard::save_clipboard_data()
+void WaylandClipboard::handle_selection(Capture &capture, std::shared_ptr<Offer> offer)
 {
-    clipboard::save_history(clipboard_history);
+    // A newer offer supersedes the one being read or waited on; its reads
+    // are cancelled and it is never stored.
+    if (capture.settling || capture.offer)
+    {
+        ++capture.coalesced_offers;
+    }
+    cancel_mime_reads(capture);
+    capture.pending_entry.clear();
+    capture.partial = false;
+    capture.offer.reset();
+    capture.settling = std::move(offer);
+    if (!capture.settling)
+    {
+        capture.settle_timer.disarm();
+        return;
+    }
+    ++capture.metrics.offers;
+    capture.offered_at = std::chrono::steady_clock::now();
+    if (capture.settle_time.count() == 0)
+    {
+        start_settled_capture(capture);
+        return;
+    }
+    capture.settle_timer.arm(capture.settle_time);
+}
+
+void WaylandClipboard::start_settled_capture(Capture &capture)
+{
+    if (capture.settling)
+    {
+        start_capture(capture, std::move(capture.settling));
+    }
 }
 
-void WaylandClipboard::handle_selection(std::shared_ptr<Offer> offer)
+void WaylandClipboard::start_capture(Capture &capture, std::shared_ptr<Offer> offer)
 {
-    if (this->offer && !clipboard_history.empty() && clipboard_history.front().empty())
+    capture.offer = offer;
+    if (offer && offer->is_restore())
     {
-        clipboard_history.erase(clipboard_history.begin());
+        // Our own selection; the entry was already moved to the front.
+        capture.offer.reset();
+        return;
     }
-    finish_current_mime_read();
-    this->offer = offer;
     if (!offer || !offer->has_mime_types())
     {
         std::cerr << "No MIME types available in the offer" << std::endl;
+        capture.offer.reset();
         return;
     }
 
-    clipboard_history.insert(clipboard_history.begin(), clipboard::ClipboardEntry());
-    clipboard::trim_history(clipboard_history);
-    if (!start_next_mime_read())
+    capture.offer_deadline = std::chrono::steady_clock::now() + capture.offer_timeout;
+    if (!start_mime_reads(capture))
     {
-        clipboard_history.erase(clipboard_history.begin());
-        this->offer.reset();
+        capture.offer.reset();
     }
 }
 
-bool WaylandClipboard::start_next_mime_read()
+bool WaylandClipboard::start_mime_reads(Capture &capture)
 {
-    if (!offer || !offer->has_mime_types())
+    const auto &offer = capture.offer;
+    if (!offer)
     {
         return false;
     }
 
-    int pipe_fds[2] = {-1, -1};
-    if (pipe(pipe_fds) < 0)
+    bool started = false;
+    while (capture.mime_reads.size() < MAX_CONCURRENT_MIME_READS && offer->has_mime_types())
+    {
+        int pipe_fds[2] = {-1, -1};
+        if (pipe(pipe_fds) < 0)
+        {
+            perror("pipe");
+            break;
+        }
+        clipboard::UniqueFd read_pipe(pipe_fds[READ_FD_INDEX]);
+        clipboard::UniqueFd write_pipe(pipe_fds[WRITE_FD_INDEX]);
+
+        if (!clipboard::set_nonblocking(read_pipe.get()))
+        {
+            perror("fcntl");
+            break;
+        }
+
+        const int fd = read_pipe.get();
+        if (!loop.add(fd, EPOLLIN, [this, &capture, fd](std::uint32_t)
+                      { handle_mime_read_event(capture, fd); }))
+        {
+            break;
+        }
+
+        MimeRead read;
+        read.mime = offer->pop_mime_type();
+        read.fd = std::move(read_pipe);
+        read.progress.started_at = capture.last_progress = std::chrono::steady_clock::now();
+        offer->receive_mime(read.mime, write_pipe.get());
+        capture.mime_reads.push_back(std::move(read));
+        ++capture.metrics.reads_started;
+        started = true;
+    }
+
+    if (started && wl_display_flush(connection.get_display()) < 0)
     {
-        perror("pipe");
+        std::cerr << "Failed to flush Wayland display" << std::endl;
+        cancel_mime_reads(capture);
         return false;
     }
-    clipboard::UniqueFd read_pipe(pipe_fds[READ_FD_INDEX]);
-    clipboard::UniqueFd write_pipe(pipe_fds[WRITE_FD_INDEX]);
+    update_read_timer();
+    return !capture.mime_reads.empty();
+}
+
+void WaylandClipboard::cancel_mime_reads(Capture &capture)
+{
+    for (const auto &read : capture.mime_reads)
+    {
+        loop.remove(read.fd.get());
+    }
+    capture.metrics.reads_cancelled += capture.mime_reads.size();
+    capture.mime_reads.clear();
+    capture.pending_commits = 0;
+    ++capture.reads_serial;
+    capture.text_summary.reset();
+    update_read_timer();
+}
 
-    if (!clipboard::set_nonblocking(read_pipe.get()))
+void WaylandClipboard::update_read_timer()
+{
+    std::optional<std::chrono::steady_clock::time_point> next;
+    for (const auto *capture : {&selection, &primary})
+    {
+        for (const auto &read : capture->mime_reads)
+        {
+            const auto deadline = read_deadline(*capture, read);
+            next = next ? std::min(*next, deadline) : deadline;
+        }
+    }
+    if (!next)
+    {
+        read_timer.disarm();
+        return;
+    }
+    // A zero timeout would disarm the timer instead of firing it.
+    const auto wait = std::chrono::ceil<std::chrono::milliseconds>(*next - std::chrono::steady_clock::now());
+    read_timer.arm(std::max(wait, std::chrono::milliseconds(1)));
+}
+
+void WaylandClipboard::cleanup()
+{
+    for (auto *capture : {&selection, &primary})
+    {
+        cancel_mime_reads(*capture);
+        capture->pending_entry.clear();
+        capture->offer.reset();
+        capture->settling.reset();
+        // Entries captured within the durability window reach the disk
+        // before the watcher exits.
+        if (!capture->log.flush())
+        {
+            std::cerr << "Failed to write clipboard history" << std::endl;
+        }
+    }
+    if (!metrics_file.empty())
     {
-        perror("fcntl");
+        write_metrics();
+    }
+    control.close();
+    sender.clear();
+    destroy_source();
+}
+
+std::string WaylandClipboard::handle_control_request(std::string_view request)
+{
+    std::size_t index = 0;
+    std::uint64_t hash = 0;
+    if (!clipboard::decode_select_request(request, index, hash))
+    {
+        return "error unknown request";
+    }
+
+    // The history may have moved on since the picker read it.
+    if (index >= selection.history.size() || selection.log.digest(index).hash != hash)
+    {
+        clipboard::EntryDigest digest;
+        digest.hash = hash;
+        const auto found = selection.log.find(digest);
+        if (!found)
+        {
+            return "error entry is no longer in history";
+        }
+        index = *found;
+    }
+
+    if (!set_selection(selection.history[index]))
+    {
+        return "error failed to set selection";
+    }
+    if (index != 0)
+    {
+        selection.log.promote(selection.history, index);
+    }
+    selection.copied = true;
+    return "ok";
+}
+
+std::optional<WaylandClipboard::ServedEntry::Bytes> WaylandClipboard::ServedEntry::find(std::string_view mime) const
+{
+    const auto id = clipboard::find_mime(mime);
+    if (!id)
+    {
+        return std::nullopt;
+    }
+    const auto payload = entry.find(*id);
+    if (payload == entry.end())
+    {
+        return std::nullopt;
+    }
+    if (!payload->second.is_blob())
+    {
+        return Bytes{payload->second.data(), payload->second.is_mapped()};
+    }
+    return Bytes{blobs.at(*id).data(), true};
+}
+
+bool WaylandClipboard::set_selection(const clipboard::ClipboardEntry &entry)
+{
+    auto next = std::make_shared<ServedEntry>();
+    next->entry = entry;
+    for (const auto &[mime, payload] : entry)
+    {
+        if (payload.is_blob() && !next->blobs[mime].open(payload.blob_path()))
+        {
+            std::cerr << "Failed to map clipboard blob " << payload.blob_path() << std::endl;
+            return false;
+        }
+    }
+
+    auto *next_source = zwlr_data_control_manager_v1_create_data_source(connection.get_data_control_manager());
+    if (!next_source)
+    {
+        std::cerr << "Failed to create data source" << std::endl;
         return false;
     }
+    zwlr_data_control_source_v1_add_listener(next_source, &source_listener, this);
+    for (const auto &[mime, payload] : entry)
+    {
+        zwlr_data_control_source_v1_offer(next_source, clipboard::mime_name(mime).c_str());
+    }
+    zwlr_data_control_source_v1_offer(next_source, HISTORY_RESTORE_MIME);
+    zwlr_data_control_device_v1_set_selection(connection.get_data_control_device(), next_source);
 
-    read_fd = read_pipe.release();
-    current_mime = offer->pop_mime_type();
-    current_content.clear();
-    offer->receive_mime(current_mime, write_pipe.get());
-    write_pipe.reset();
+    // Pastes already running from the previous source keep their entry.
+    destroy_source();
+    source = next_source;
+    served = std::move(next);
     if (wl_display_flush(connection.get_display()) < 0)
     {
         std::cerr << "Failed to flush Wayland display" << std::endl;
-        finish_current_mime_read();
         return false;
     }
     return true;
 }
 
-void WaylandClipboard::finish_current_mime_read()
+void WaylandClipboard::destroy_source()
 {
-    if (read_fd >= 0)
+    if (source)
     {
-        close(read_fd);
-        read_fd = -1;
+        zwlr_data_control_source_v1_destroy(source);
+        source = nullptr;
     }
-    current_mime.clear();
-    current_content.clear();
+    served.reset();
 }
 
-void WaylandClipboard::cleanup()
+void WaylandClipboard::source_send_s(void *data, zwlr_data_control_source_v1 *source, const char *mime, int32_t fd)
+{
+    clipboard::UniqueFd output(fd);
+    auto *self = static_cast<WaylandClipboard *>(data);
+    if (source != self->source || !self->served)
+    {
+        return;
+    }
+    if (const auto payload = self->served->find(mime))
+    {
+        self->sender.send(std::move(output), payload->data, self->served, payload->file_backed);
+    }
+}
+
+void WaylandClipboard::source_cancelled_s(void *data, zwlr_data_control_source_v1 *source)
 {
-    finish_current_mime_read();
-    offer.reset();
+    auto *self = static_cast<WaylandClipboard *>(data);
+    // Replaced sources are destroyed right away, so only the current one
+    // can be cancelled.
+    if (source == self->source)
+    {
+        self->destroy_source();
+    }
 }
+
+const zwlr_data_control_source_v1_listener WaylandClipboard::source_listener = {
+    .send = source_send_s,
+    .cancelled = source_cancelled_s,
+};
@@ -3,16 +3,64 @@
 #include <wayland-client.h>
 #include <wlr-data-control-unstable-v1-client-protocol.h>
 #include "WaylandConnection.h"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <string>
-#include <queue>
 #include <map>
 #include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "BlobStore.h"
 #include "ClipboardHistory.h"
+#include "ControlSocket.h"
+#include "EventLoop.h"
+#include "HistoryLog.h"
+#include "Metrics.h"
+#include "PayloadSender.h"
+#include "PosixIO.h"
+#include "ReadDeadline.h"
+
+struct CaptureOptions
+{
+    clipboard::HistoryLimits limits;
+    // An offer is only read once no newer one has arrived for this long, so
+    // a burst of selections costs one read and one history write. Zero reads
+    // every offer.
+    std::chrono::milliseconds settle_time{50};
+    // A MIME read still open this long after it started is abandoned, and
+    // an offer whose reads have not finished within offer_timeout is stored
+    // with what was read by then. Either way the entry is flagged partial.
+    std::chrono::milliseconds read_timeout{5000};
+    std::chrono::milliseconds offer_timeout{10000};
+};
+
+struct WatcherOptions
+{
+    CaptureOptions clipboard;
+    // Capture of the primary selection (the text last selected with the
+    // mouse) into a history of its own. Dragging a selection replaces the
+    // primary offer many times a second, hence the longer settle time.
+    bool primary = false;
+    CaptureOptions primary_capture{.limits = {}, .settle_time = std::chrono::milliseconds(500)};
+    // History writes are batched on a background thread over this long;
+    // entries captured within it are lost if the watcher is killed.
+    std::chrono::milliseconds durability_window{500};
+    // Counters and latencies are written here in the Prometheus text format
+    // every metrics_interval and on exit. Empty disables them.
+    std::filesystem::path metrics_file;
+    std::chrono::milliseconds metrics_interval{10000};
+};
 
 class WaylandClipboard
 {
 public:
-    WaylandClipboard() = default;
+    explicit WaylandClipboard(const WatcherOptions &options = {})
+        : selection(clipboard::history_path(), options.clipboard),
+          primary(clipboard::primary_history_path(), options.primary_capture),
+          capture_primary(options.primary), durability_window(options.durability_window),
+          metrics_file(options.metrics_file), metrics_interval(options.metrics_interval) {}
     ~WaylandClipboard();
 
     // Delete copy constructor and assignment operator
@@ -23,27 +71,152 @@ public:
     int run();
 
 private:
+    struct MimeRead
+    {
+        clipboard::MimeId mime = 0;
+        clipboard::UniqueFd fd;
+        std::string content;
+        // Payloads past the spill threshold continue in a blob file.
+        clipboard::BlobWriter blob;
+        bool can_splice = true;
+        bool truncated = false;
+        // Ended by a deadline rather than by the source closing the pipe.
+        bool stalled = false;
+        bool finished = false;
+        clipboard::MimeReadProgress progress;
+    };
+
+    // A history entry the watcher is serving as the selection. Transfers
+    // keep it alive after a newer selection replaces it.
+    struct ServedEntry
+    {
+        clipboard::ClipboardEntry entry;
+        std::map<clipboard::MimeId, clipboard::MappedFile> blobs;
+
+        // The bytes served for a MIME type; file_backed when they lie in a
+        // blob or history log mapping rather than on the heap.
+        struct Bytes
+        {
+            std::string_view data;
+            bool file_backed = false;
+        };
+        std::optional<Bytes> find(std::string_view mime) const;
+    };
+
+    // What one selection's capture has done, for the metrics file.
+    struct CaptureMetrics
+    {
+        std::uint64_t offers = 0;
+        std::uint64_t reads_started = 0;
+        std::uint64_t reads_finished = 0;
+        std::uint64_t reads_truncated = 0;
+        std::uint64_t reads_cancelled = 0;
+        std::uint64_t reads_stalled = 0;
+        // Blobs that could not be stored, kept in memory or lost.
+        std::uint64_t blob_commits_failed = 0;
+        std::uint64_t offers_timed_out = 0;
+        std::uint64_t entries_stored = 0;
+        std::uint64_t duplicates = 0;
+        std::map<clipboard::MimeId, std::uint64_t> captured_bytes;
+        // From the offer to its entry being handed to the log, settle time
+        // included.
+        clipboard::LatencyHistogram capture_latency;
+    };
+
+    // Offers of one selection and the history they are read into.
+    struct Capture
+    {
+        Capture(std::filesystem::path path, const CaptureOptions &options)
+            : log(std::move(path), options.limits), settle_time(options.settle_time),
+              read_timeout(options.read_timeout), offer_timeout(options.offer_timeout) {}
+
+        // The newest offer, waiting out settle_time before it is read.
+        std::shared_ptr<Offer> settling = nullptr;
+        clipboard::TimerFd settle_timer;
+        std::shared_ptr<Offer> offer = nullptr;
+        std::vector<MimeRead> mime_reads;
+        clipboard::ClipboardEntry pending_entry;
+        // Blobs of finished reads still being committed off the loop; the
+        // entry is complete once none are left.
+        std::size_t pending_commits = 0;
+        // Bumped when reads are cancelled, so the commits of a superseded
+        // offer are ignored.
+        std::uint64_t reads_serial = 0;
+        // summarize_text of a text/plain blob, made off the loop with its
+        // commit.
+        std::optional<clipboard::EntrySummary> text_summary;
+        // Some payload of pending_entry is incomplete.
+        bool partial = false;
+        clipboard::ClipboardHistory history;
+        clipboard::HistoryLog log;
+        std::filesystem::path blob_dir;
+        std::chrono::milliseconds settle_time;
+        std::chrono::milliseconds read_timeout;
+        std::chrono::milliseconds offer_timeout;
+        std::chrono::steady_clock::time_point offer_deadline;
+        // When a read of the offer last received data, or reads were started.
+        std::chrono::steady_clock::time_point last_progress;
+        bool copied = false;
+        // Offers replaced before they were stored, each a history write saved.
+        std::uint64_t coalesced_offers = 0;
+        std::chrono::steady_clock::time_point offered_at;
+        CaptureMetrics metrics;
+    };
+
     WaylandConnection connection;
-    int read_fd = -1;
-    std::shared_ptr<Offer> offer = nullptr;
-    clipboard::ClipboardHistory clipboard_history;
-    std::string current_mime;
-    std::string current_content;
-    bool copied = false;
+    clipboard::EventLoop loop;
+    clipboard::TimerFd read_timer;
+    clipboard::SignalFd signals;
+    bool wayland_readable = false;
+    bool stop_requested = false;
+    Capture selection;
+    Capture primary;
+    bool capture_primary = false;
+    std::chrono::milliseconds durability_window;
+    std::filesystem::path metrics_file;
+    std::chrono::milliseconds metrics_interval;
+    clipboard::TimerFd metrics_timer;
+    clipboard::ControlServer control{loop};
+    clipboard::PayloadSender sender{loop};
+    clipboard::BlobCommitter blob_committer;
+    zwlr_data_control_source_v1 *source = nullptr;
+    std::shared_ptr<const ServedEntry> served;
 
     // Callback implementations
-    void handle_selection(std::shared_ptr<Offer> offer);
+    void handle_selection(Capture &capture, std::shared_ptr<Offer> offer);
+    void start_settled_capture(Capture &capture);
 
     void cleanup();
 
     // Helper methods for run() function
-    void setup_polling(struct pollfd fds[2]);
-    bool handle_wayland_events(struct pollfd fds[2]);
-    void process_clipboard_data(bool has_pipe_data);
-    void handle_offer_completion();
-    bool start_next_mime_read();
-    void finish_current_mime_read();
-
-    void save_clipboard_data();
+    bool setup_event_loop();
+    bool start_control_socket();
+    bool start_metrics_timer();
+    std::string render_metrics() const;
+    void write_metrics() const;
+    void handle_mime_read_event(Capture &capture, int fd);
+    void expire_mime_reads();
+    static std::chrono::steady_clock::time_point read_deadline(const Capture &capture, const MimeRead &read);
+    void collect_finished_mime_reads(Capture &capture);
+    void handle_blob_commit(Capture &capture, std::uint64_t serial, clipboard::MimeId mime,
+                            clipboard::BlobCommitter::Result result);
+    void complete_offer_if_read(Capture &capture);
+    bool drain_mime_read(Capture &capture, MimeRead &read, bool has_pipe_data);
+    bool store_mime_data(const Capture &capture, MimeRead &read, std::string_view data);
+    void handle_offer_completion(Capture &capture);
+    static bool shares_payload(const clipboard::EntryDigest &a, const clipboard::EntryDigest &b);
+    void start_capture(Capture &capture, std::shared_ptr<Offer> offer);
+    bool start_mime_reads(Capture &capture);
+    void cancel_mime_reads(Capture &capture);
+    void update_read_timer();
+
     void load_clipboard_data();
+
+    // Control socket and restoring entries as the selection
+    std::string handle_control_request(std::string_view request);
+    bool set_selection(const clipboard::ClipboardEntry &entry);
+    void destroy_source();
+    static void source_send_s(void *data, zwlr_data_control_source_v1 *source, const char *mime, int32_t fd);
+    static void source_cancelled_s(void *data, zwlr_data_control_source_v1 *source);
+    static const zwlr_data_control_source_v1_listener source_listener;
 };
@@ -1,7 +1,7 @@
 #include "WaylandConnection.h"
 #include <iostream>
 #include <string>
-#include <algorithm>
+#include <utility>
 
 WaylandConnection::~WaylandConnection()
 {
@@ -112,21 +112,18 @@ void WaylandConnection::handle_registry_global(wl_registry *reg, uint32_t name,
     }
 }
 
-std::shared_ptr<Offer> WaylandConnection::get_offer(zwlr_data_control_offer_v1 *offer, bool pop)
+std::shared_ptr<Offer> WaylandConnection::take_offer(zwlr_data_control_offer_v1 *offer)
 {
-    auto it = std::ranges::find_if(offers,
-                                   [offer](const std::shared_ptr<Offer> &o)
-                                   { return o->matches(offer); });
-    if (it != offers.end())
-    {
-        auto offer = *it;
-        if (pop)
-        {
-            offers.erase(it);
-        }
-        return offer;
-    }
-    throw std::runtime_error("Offer not found");
+    const auto it = offers.find(offer);
+    if (it == offers.end())
+    {
+        return nullptr;
+    }
+    auto taken = std::move(it->second);
+    offers.erase(it);
+    std::erase_if(offers, [&taken](const auto &pending)
+                  { return pending.second.serial < taken.serial; });
+    return std::move(taken.offer);
 }
 
 bool WaylandConnection::create_data_control_device()
@@ -152,9 +149,14 @@ bool WaylandConnection::create_data_control_device()
 }
 
 // New static callback wrappers for data control
-void WaylandConnection::offer_handle_wrapper(void *data, zwlr_data_control_offer_v1 *offer, const char *mime_type)
+void WaylandConnection::offer_handle_wrapper(void *data, zwlr_data_control_offer_v1 *, const char *mime_type)
 {
-    static_cast<WaylandConnection *>(data)->handle_offer(offer, mime_type);
+    if (!mime_type)
+    {
+        std::cerr << "Received null mime_type" << std::endl;
+        return;
+    }
+    static_cast<Offer *>(data)->add_mime_type(mime_type);
 }
 
 void WaylandConnection::selection_handle_wrapper(void *data, zwlr_data_control_device_v1 *device, zwlr_data_control_offer_v1 *offer)
@@ -168,40 +170,36 @@ void WaylandConnection::data_offer_wrapper(void *data, zwlr_data_control_device_
 }
 
 // New member function implementations for data control
-void WaylandConnection::handle_offer(zwlr_data_control_offer_v1 *offer_ptr, const char *mime_type)
+void WaylandConnection::handle_selection(zwlr_data_control_device_v1 *, zwlr_data_control_offer_v1 *offer_ptr)
 {
-    if (!offer_ptr || !mime_type)
+    if (!offer_ptr)
     {
-        std::cerr << "Received null offer or mime_type" << std::endl;
         return;
     }
-    try
+    auto offer = take_offer(offer_ptr);
+    if (!offer)
     {
-        auto offer = get_offer(offer_ptr);
-        offer->add_mime_type(mime_type);
+        std::cerr << "Selection names an unknown offer" << std::endl;
+        return;
     }
-    catch (const std::runtime_error &e)
+    if (offer_ready_callback)
     {
-        std::cerr << "Error handling offer: " << e.what() << std::endl;
+        offer_ready_callback(std::move(offer));
     }
 }
 
-void WaylandConnection::handle_selection(zwlr_data_control_device_v1 *, zwlr_data_control_offer_v1 *offer_ptr)
+void WaylandConnection::handle_primary_selection(zwlr_data_control_device_v1 *, zwlr_data_control_offer_v1 *offer_ptr)
 {
-    if (!offer_ptr)
+    // Without a callback the offer is dropped, which destroys it.
+    auto offer = offer_ptr ? take_offer(offer_ptr) : nullptr;
+    if (offer_ptr && !offer)
     {
+        std::cerr << "Primary selection names an unknown offer" << std::endl;
         return;
     }
-    if (offer_ready_callback)
+    if (primary_offer_callback)
     {
-        try
-        {
-            offer_ready_callback(get_offer(offer_ptr, true));
-        }
-        catch (const std::runtime_error &e)
-        {
-            std::cerr << "Error handling offer: " << e.what() << std::endl;
-        }
+        primary_offer_callback(std::move(offer));
     }
 }
 
@@ -212,12 +210,13 @@ void WaylandConnection::handle_data_offer(zwlr_data_control_device_v1 *, zwlr_da
         std::cerr << "Received null offer" << std::endl;
         return;
     }
+    auto pending = std::make_shared<Offer>(offer);
     wl_proxy_set_queue((struct wl_proxy *)offer, event_queue);
-    zwlr_data_control_offer_v1_add_listener(offer, &offer_listener, this);
+    zwlr_data_control_offer_v1_add_listener(offer, &offer_listener, pending.get());
     if (wl_display_flush(display) < 0)
     {
         std::cerr << "Failed to flush Wayland display" << std::endl;
         running = false;
     }
-    offers.push_back(std::make_shared<Offer>(offer));
+    offers[offer] = {.offer = std::move(pending), .serial = next_offer_serial++};
 }
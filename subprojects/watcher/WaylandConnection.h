@@ -2,10 +2,11 @@
 
 #include <wayland-client.h>
 #include <wlr-data-control-unstable-v1-client-protocol.h>
+#include <cstdint>
 #include <string>
 #include <functional>
-#include <list>
 #include <memory>
+#include <unordered_map>
 #include "Offer.h"
 
 class WaylandConnection
@@ -31,6 +32,9 @@ public:
 
     // Callback registration
     void set_offer_ready_callback(std::function<void(std::shared_ptr<Offer>)> callback) { offer_ready_callback = callback; }
+    // Without one, primary selection offers are dropped. A null offer means
+    // the primary selection was cleared.
+    void set_primary_offer_callback(std::function<void(std::shared_ptr<Offer>)> callback) { primary_offer_callback = callback; }
 
     // Create data control device
     bool create_data_control_device();
@@ -42,27 +46,40 @@ private:
     wl_seat *seat = nullptr;
     zwlr_data_control_manager_v1 *dc_manager = nullptr;
     zwlr_data_control_device_v1 *dc_device = nullptr;
-    std::list<std::shared_ptr<Offer>> offers;
+    // Offers introduced by data_offer that no selection event has named
+    // yet. Each is named right after its MIME types, so any introduced
+    // before the one a selection event names can never be named and is
+    // dropped then, which keeps this to a few live offers.
+    struct PendingOffer
+    {
+        std::shared_ptr<Offer> offer;
+        std::uint64_t serial = 0;
+    };
+    std::unordered_map<zwlr_data_control_offer_v1 *, PendingOffer> offers;
+    std::uint64_t next_offer_serial = 0;
     bool running = true;
 
-    std::shared_ptr<Offer> get_offer(zwlr_data_control_offer_v1 *offer, bool pop = false);
+    // Removes the offer from the pending set; null if it is unknown.
+    std::shared_ptr<Offer> take_offer(zwlr_data_control_offer_v1 *offer);
 
     // Callbacks
     std::function<void(std::shared_ptr<Offer>)> offer_ready_callback;
+    std::function<void(std::shared_ptr<Offer>)> primary_offer_callback;
 
     // Static callback wrappers for registry
     static void registry_global_wrapper(void *data, wl_registry *reg, uint32_t name, const char *iface, uint32_t ver);
     static void registry_global_remove_wrapper(void *, wl_registry *, uint32_t);
 
     // Static callback wrappers for data control
+    // Offer listeners get their Offer as user data.
     static void offer_handle_wrapper(void *data, zwlr_data_control_offer_v1 *offer, const char *mime_type);
     static void selection_handle_wrapper(void *data, zwlr_data_control_device_v1 *device, zwlr_data_control_offer_v1 *offer);
     static void data_offer_wrapper(void *data, zwlr_data_control_device_v1 *dev, zwlr_data_control_offer_v1 *offer);
 
     // Member function implementations
     void handle_registry_global(wl_registry *reg, uint32_t name, const char *iface, uint32_t);
-    void handle_offer(zwlr_data_control_offer_v1 *offer, const char *mime_type);
     void handle_selection(zwlr_data_control_device_v1 *device, zwlr_data_control_offer_v1 *offer);
+    void handle_primary_selection(zwlr_data_control_device_v1 *device, zwlr_data_control_offer_v1 *offer);
     void handle_data_offer(zwlr_data_control_device_v1 *dev, zwlr_data_control_offer_v1 *offer);
 
     // Listener structures
@@ -79,12 +96,7 @@ private:
         .finished = [](void *data,
                        struct zwlr_data_control_device_v1 *)
         { static_cast<WaylandConnection *>(data)->running = false; },
-        .primary_selection = [](void *, zwlr_data_control_device_v1 *, zwlr_data_control_offer_v1 *offer)
-        {
-            if (offer)
-            {
-                zwlr_data_control_offer_v1_destroy(offer);
-            }
-        },
+        .primary_selection = [](void *data, zwlr_data_control_device_v1 *device, zwlr_data_control_offer_v1 *offer)
+        { static_cast<WaylandConnection *>(data)->handle_primary_selection(device, offer); },
     };
 };
@@ -1,9 +1,118 @@
 #include "WaylandClipboard.h"
+#include "StringUtils.h"
+#include <chrono>
 #include <iostream>
+#include <string_view>
 
-int main()
+namespace
 {
-  WaylandClipboard clipboard;
+void print_usage(const char *argv0)
+{
+  std::cerr << "Usage: " << argv0 << " [--max-entries N] [--max-bytes SIZE[K|M|G]] [--settle-ms MS]"
+            << " [--read-timeout-ms MS] [--offer-timeout-ms MS]"
+            << " [--durability-window-ms MS] [--metrics-file PATH [--metrics-interval-ms MS]]"
+            << " [--primary [--primary-max-entries N] [--primary-max-bytes SIZE[K|M|G]] [--primary-settle-ms MS]]"
+            << std::endl;
+}
+
+bool parse_options(int argc, char *argv[], WatcherOptions &options)
+{
+  bool primary_options = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string_view option = argv[i];
+    if (option == "--primary")
+    {
+      options.primary = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      return false;
+    }
+    if (option == "--metrics-file")
+    {
+      options.metrics_file = argv[++i];
+      if (options.metrics_file.empty())
+      {
+        return false;
+      }
+      continue;
+    }
+    if (!option.starts_with("--"))
+    {
+      return false;
+    }
+    // Sizes take a K, M or G suffix; counts and milliseconds are plain numbers.
+    const std::string_view text = argv[++i];
+    const auto value = option.ends_with("max-bytes") ? clipboard::parse_byte_size(text) : clipboard::parse_unsigned(text);
+    if (!value)
+    {
+      return false;
+    }
+    if (option == "--durability-window-ms")
+    {
+      options.durability_window = std::chrono::milliseconds(*value);
+      continue;
+    }
+    if (option == "--metrics-interval-ms")
+    {
+      if (*value == 0)
+      {
+        return false;
+      }
+      options.metrics_interval = std::chrono::milliseconds(*value);
+      continue;
+    }
+    // --primary-X sets option --X of the primary selection capture.
+    const bool primary = option.starts_with("--primary-");
+    auto &capture = primary ? options.primary_capture : options.clipboard;
+    const auto name = option.substr(primary ? std::string_view("--primary-").size() : 2);
+    primary_options = primary_options || primary;
+    if (name == "settle-ms")
+    {
+      capture.settle_time = std::chrono::milliseconds(*value);
+    }
+    else if (*value == 0)
+    {
+      return false;
+    }
+    else if (name == "max-entries")
+    {
+      capture.limits.max_entries = static_cast<std::size_t>(*value);
+    }
+    else if (name == "max-bytes")
+    {
+      capture.limits.max_bytes = *value;
+    }
+    else if (name == "read-timeout-ms")
+    {
+      capture.read_timeout = std::chrono::milliseconds(*value);
+    }
+    else if (name == "offer-timeout-ms")
+    {
+      capture.offer_timeout = std::chrono::milliseconds(*value);
+    }
+    else
+    {
+      return false;
+    }
+  }
+  // The primary options mean nothing without --primary.
+  return options.primary || !primary_options;
+}
+}
+
+int main(int argc, char *argv[])
+{
+  WatcherOptions options;
+  if (!parse_options(argc, argv, options))
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  WaylandClipboard clipboard(options);
 
   if (!clipboard.initialize())
   {
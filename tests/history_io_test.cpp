@@ -1,13 +1,42 @@
+#include "Base64.h"
+#include "BlobStore.h"
 #include "ClipboardHistory.h"
+#include "ContentHash.h"
+#include "ControlSocket.h"
+#include "EventLoop.h"
+#include "FuzzyMatch.h"
+#include "HistoryLog.h"
+#include "HistoryView.h"
+#include "Metrics.h"
+#include "MimeType.h"
+#include "PayloadCodec.h"
+#include "PayloadSender.h"
 #include "PosixIO.h"
+#include "ReadDeadline.h"
 #include "StringUtils.h"
+#include "TextSearch.h"
 
+#include <algorithm>
 #include <cassert>
+#include <csignal>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
+#include <format>
 #include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <string>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <vector>
 
 namespace
 {
@@ -19,6 +48,54 @@ std::filesystem::path make_temp_dir()
     return path;
 }
 
+// The decoder load_history used before the vectorized codec, kept as the
+// reference for valid input.
+std::string reference_base64_decode(const std::string &encoded)
+{
+    const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    std::uint32_t group = 0;
+    int bits = 0;
+    for (char c : encoded)
+    {
+        if (c == '=')
+        {
+            break;
+        }
+        group = (group << 6) | static_cast<std::uint32_t>(chars.find(c));
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out += static_cast<char>((group >> bits) & 0xff);
+        }
+    }
+    return out;
+}
+
+// Whether every thread besides the calling one blocks signal.
+bool other_threads_block(int signal)
+{
+    for (const auto &task : std::filesystem::directory_iterator("/proc/self/task"))
+    {
+        if (task.path().filename() == std::to_string(gettid()))
+        {
+            continue;
+        }
+        std::ifstream status(task.path() / "status");
+        std::string line;
+        while (std::getline(status, line) && !line.starts_with("SigBlk:"))
+        {
+        }
+        const auto blocked = std::stoull(line.substr(std::strlen("SigBlk:")), nullptr, 16);
+        if (!((blocked >> (signal - 1)) & 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 void use_data_home(const std::filesystem::path &path)
 {
     setenv("XDG_DATA_HOME", path.c_str(), 1);
@@ -31,6 +108,7 @@ void test_missing_and_invalid_history()
     use_data_home(dir);
 
     assert(clipboard::load_history().empty());
+    assert(!clipboard::HistoryView::may_have_entries());
 
     std::filesystem::create_directories(dir);
     std::ofstream file(clipboard::history_path());
@@ -46,15 +124,16 @@ void test_history_round_trip_and_limit()
     const auto dir = make_temp_dir();
     use_data_home(dir);
 
+    const clipboard::HistoryLimits limits;
     clipboard::ClipboardHistory history;
-    for (std::size_t i = 0; i < clipboard::max_history_size + 5; ++i)
+    for (std::size_t i = 0; i < limits.max_entries + 5; ++i)
     {
         history.push_back({{"text/plain", "entry " + std::to_string(i)}});
     }
 
     assert(clipboard::save_history(history));
     auto loaded = clipboard::load_history();
-    assert(loaded.size() == clipboard::max_history_size);
+    assert(loaded.size() == limits.max_entries);
     assert(loaded.front().at("text/plain") == "entry 0");
     assert(loaded.back().at("text/plain") == "entry 24");
 
@@ -81,13 +160,782 @@ void test_history_preserves_binary_and_whitespace()
     std::filesystem::remove_all(dir);
 }
 
+void test_legacy_json_import()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    std::ofstream file(clipboard::legacy_history_path());
+    file << R"([{"text/plain": "aGVsbG8="}, {"text/plain": "d29ybGQ="}])";
+    file.close();
+
+    assert(clipboard::HistoryView::may_have_entries());
+    assert(!clipboard::HistoryView::may_have_entries(clipboard::primary_history_path()));
+
+    auto loaded = clipboard::load_history();
+    assert(loaded.size() == 2);
+    assert(loaded.front().at("text/plain") == "hello");
+
+    // The legacy history only ever held the clipboard, not the primary selection.
+    clipboard::HistoryView primary_view;
+    assert(primary_view.open(clipboard::primary_history_path()));
+    assert(primary_view.empty());
+    clipboard::HistoryLog primary(clipboard::primary_history_path());
+    auto primary_history = primary.open();
+    assert(primary_history.empty());
+    assert(!clipboard::HistoryView::may_have_entries(clipboard::primary_history_path()));
+    assert(primary.push_front(primary_history, {{"text/plain", "selected"}}));
+    assert(clipboard::HistoryView::may_have_entries(clipboard::primary_history_path()));
+    assert(primary_view.open(clipboard::primary_history_path()));
+    assert(primary_view.size() == 1);
+
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(history == loaded);
+    assert(std::filesystem::exists(clipboard::history_path()));
+
+    std::filesystem::remove(clipboard::legacy_history_path());
+    assert(clipboard::load_history() == loaded);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_history_log_appends()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    const clipboard::HistoryLimits limits;
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(history.empty());
+
+    for (std::size_t i = 0; i < limits.max_entries + 3; ++i)
+    {
+        assert(log.push_front(history, {{"text/plain", "entry " + std::to_string(i)}}));
+    }
+    assert(log.erase(history, 1));
+    assert(history.size() == limits.max_entries - 1);
+    assert(history.front().at("text/plain") == "entry 27");
+    assert(history[1].at("text/plain") == "entry 25");
+    assert(clipboard::load_history() == history);
+
+    const auto size_before = std::filesystem::file_size(clipboard::history_path());
+    assert(log.push_front(history, {{"text/plain", "appended"}}));
+    const auto size_after = std::filesystem::file_size(clipboard::history_path());
+    assert(size_after - size_before ==
+           clipboard::payload_record_size(clipboard::Payload("appended")) + clipboard::push_record_size(log.digest(0)));
+
+    {
+        std::ofstream torn(clipboard::history_path(), std::ios::binary | std::ios::app);
+        torn << clipboard::encode_payload_record(1, "torn").substr(0, 10);
+    }
+    assert(clipboard::load_history() == history);
+
+    clipboard::HistoryLog reopened;
+    assert(reopened.open() == history);
+    assert(std::filesystem::file_size(clipboard::history_path()) == size_after);
+    auto damaged_path = clipboard::history_path();
+    damaged_path += ".damaged";
+    assert(!std::filesystem::exists(damaged_path));
+
+    // A malformed record followed by more data is damage, not a torn
+    // append: the log is kept aside and rewritten from what was read.
+    {
+        std::ofstream damaged(clipboard::history_path(), std::ios::binary | std::ios::app);
+        const std::uint32_t type = 0xdead;
+        const std::uint64_t size = 0;
+        damaged.write(reinterpret_cast<const char *>(&type), sizeof(type));
+        damaged.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        damaged << clipboard::encode_payload_record(2, "after the damage");
+    }
+    const auto damaged_size = std::filesystem::file_size(clipboard::history_path());
+    clipboard::HistoryLog recovered;
+    assert(recovered.open() == history);
+    assert(std::filesystem::file_size(damaged_path) == damaged_size);
+    assert(clipboard::load_history() == history);
+    assert(std::filesystem::file_size(clipboard::history_path()) < damaged_size);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_background_log_writes()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    // A window long enough that every push below joins the first batch.
+    log.write_in_background(std::chrono::seconds(10));
+    for (int i = 0; i < 5; ++i)
+    {
+        assert(log.push_front(history, {{"text/plain", "entry " + std::to_string(i)}}));
+    }
+    assert(log.promote(history, 3));
+    assert(log.flush());
+    assert(log.coalesced_writes() == 5);
+    assert(log.background_writer()->write_latency().count() == 1);
+
+    clipboard::HistoryLog reopened;
+    auto reloaded = reopened.open();
+    assert(reloaded == history);
+    assert(reloaded.front().at("text/plain") == "entry 1");
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_signal_during_background_write()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    // The writer thread is running before the signal is blocked, as in the
+    // watcher before it set up its SignalFd first.
+    log.write_in_background(std::chrono::seconds(10));
+    assert(log.push_front(history, {{"text/plain", "written"}}));
+    assert(log.flush());
+    clipboard::SignalFd signals;
+    assert(signals.create({SIGTERM}));
+    assert(log.push_front(history, {{"text/plain", "pending at shutdown"}}));
+    assert(other_threads_block(SIGTERM));
+
+    // The kernel picks among the threads not blocking a signal, so one
+    // delivery may miss an unmasked writer; repeating makes that unlikely.
+    for (int i = 0; i < 16; ++i)
+    {
+        assert(kill(getpid(), SIGTERM) == 0);
+        pollfd ready{.fd = signals.get(), .events = POLLIN, .revents = 0};
+        assert(poll(&ready, 1, 1000) == 1);
+        assert(signals.consume() == SIGTERM);
+    }
+    assert(log.flush());
+
+    clipboard::HistoryLog reopened;
+    assert(reopened.open() == history);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_metrics_text()
+{
+    clipboard::LatencyHistogram latencies;
+    latencies.observe(std::chrono::microseconds(50));
+    latencies.observe(std::chrono::milliseconds(3));
+    latencies.observe(std::chrono::seconds(60));
+    assert(latencies.count() == 3);
+    assert(latencies.cumulative_count(0) == 1);
+    assert(latencies.cumulative_count(5) == 2);
+    assert(latencies.cumulative_count(clipboard::LatencyHistogram::bounds.size() - 1) == 2);
+    assert(latencies.sum_seconds() > 60.003 && latencies.sum_seconds() < 60.0031);
+
+    clipboard::MetricsText text;
+    text.family("reads_total", "counter", "Reads.");
+    text.sample("reads_total", 7, {{"mime", "text/\"odd\""}});
+    text.family("read_seconds", "histogram", "Read time.");
+    text.histogram("read_seconds", latencies);
+    const auto &page = text.str();
+    assert(page.starts_with("# HELP reads_total Reads.\n# TYPE reads_total counter\n"
+                            "reads_total{mime=\"text/\\\"odd\\\"\"} 7\n"));
+    assert(page.contains("read_seconds_bucket{le=\"0.0001\"} 1\n"));
+    assert(page.contains("read_seconds_bucket{le=\"0.005\"} 2\n"));
+    assert(page.contains("read_seconds_bucket{le=\"+Inf\"} 3\n"));
+    assert(page.contains(std::format("read_seconds_sum {}\n", latencies.sum_seconds())));
+    assert(page.ends_with("read_seconds_count 3\n"));
+
+    const auto dir = make_temp_dir();
+    assert(clipboard::write_metrics_file(dir / "metrics.prom", page));
+    clipboard::MappedFile written;
+    assert(written.open(dir / "metrics.prom"));
+    assert(written.data() == page);
+    assert(std::distance(std::filesystem::directory_iterator(dir), std::filesystem::directory_iterator()) == 1);
+    std::filesystem::remove_all(dir);
+}
+
+void test_history_log_compaction()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    const std::string payload(256 * 1024, 'x');
+    for (std::size_t i = 0; i < 64; ++i)
+    {
+        assert(log.push_front(history, {{"image/png", payload + std::to_string(i)}}));
+    }
+
+    const auto live_size = clipboard::encode_log_header().size() +
+                           history.size() * (clipboard::payload_record_size(history.front().at("image/png")) +
+                                             clipboard::push_record_size(log.digest(0)));
+    assert(std::filesystem::file_size(clipboard::history_path()) <= 2 * live_size + 1024 * 1024);
+    assert(clipboard::load_history() == history);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_history_log_deduplicates_payloads()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    const std::string image(64 * 1024, 'i');
+    assert(log.push_front(history, {{"image/png", image}, {"text/plain", "first"}}));
+    const auto size_before = std::filesystem::file_size(clipboard::history_path());
+    assert(log.push_front(history, {{"image/png", image}, {"text/plain", "second"}}));
+    const auto size_after = std::filesystem::file_size(clipboard::history_path());
+    assert(size_after - size_before < image.size());
+
+    const auto digest = clipboard::digest_entry({{"image/png", image}, {"text/plain", "first"}});
+    assert(log.find(digest) == 1);
+    assert(!log.find(clipboard::digest_entry({{"text/plain", "missing"}})));
+    assert(log.promote(history, 1));
+    assert(log.find(digest) == 0);
+    assert(history.front().at("text/plain") == "first");
+    assert(std::filesystem::file_size(clipboard::history_path()) - size_after == clipboard::encode_promote_record(1).size());
+
+    assert(clipboard::load_history() == history);
+    clipboard::HistoryLog reopened;
+    assert(reopened.open() == history);
+    assert(reopened.find(digest) == 0);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_loaded_payloads_stay_mapped()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    const std::string image(128 * 1024, 'm');
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(log.push_front(history, {{"image/png", image}, {"text/plain", "caption"}}));
+
+    auto loaded = clipboard::load_history();
+    assert(loaded == history);
+    const auto &payload = loaded.front().at("image/png");
+    assert(payload.hash() == clipboard::content_hash(image));
+
+    // Compaction replaces the log by rename; the old mapping stays readable.
+    for (std::size_t i = 0; i < 40; ++i)
+    {
+        assert(log.push_front(history, {{"image/png", image + std::to_string(i)}}));
+    }
+    std::filesystem::remove(clipboard::history_path());
+    assert(payload.data() == image);
+    assert(payload.load() == image);
+    assert(loaded.front().at("text/plain") == "caption");
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_history_limits()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    const clipboard::HistoryLimits limits{.max_entries = 100, .max_bytes = 4096};
+    clipboard::HistoryLog log(clipboard::history_path(), limits);
+    auto history = log.open();
+    for (std::size_t i = 0; i < 50; ++i)
+    {
+        assert(log.push_front(history, {{"text/plain", "clip " + std::to_string(i)}}));
+    }
+    assert(history.size() == 50);
+
+    // Shared payloads count once towards the budget.
+    const std::string image(1500, 'i');
+    assert(log.push_front(history, {{"image/png", image}, {"text/plain", "a"}}));
+    assert(log.push_front(history, {{"image/png", image}, {"text/plain", "b"}}));
+    assert(history.size() == 52);
+    assert(log.promote(history, 10));
+    const auto restored = history.front();
+
+    const std::string large(2300, 'l');
+    assert(log.push_front(history, {{"image/png", large}}));
+    assert(log.payload_bytes() <= limits.max_bytes);
+    assert(history.size() < 52);
+    assert(history[1] == restored);
+    assert(history[2].at("text/plain") == "b");
+
+    // Evictions are logged, so a reader with the default limits agrees.
+    assert(clipboard::load_history() == history);
+    clipboard::HistoryLog wider(clipboard::history_path(), {.max_entries = 1000, .max_bytes = 1 << 20});
+    assert(wider.open() == history);
+
+    clipboard::HistoryLog narrower(clipboard::history_path(), {.max_entries = 2});
+    auto trimmed = narrower.open();
+    assert(trimmed.size() == 2);
+    assert(trimmed.front() == history.front());
+    assert(clipboard::load_history() == trimmed);
+
+    // The newest entry stays even when it alone is over budget.
+    clipboard::HistoryLog tiny(clipboard::history_path(), {.max_bytes = 16});
+    auto single = tiny.open();
+    assert(tiny.push_front(single, {{"text/plain", std::string(64, 't')}}));
+    assert(single.size() == 1);
+
+    clipboard::ClipboardHistory unsaved = {{{"text/plain", "1234"}}, {{"text/plain", "5678"}}, {{"text/plain", "9"}}};
+    clipboard::trim_history(unsaved, {.max_entries = 3, .max_bytes = 8});
+    assert(unsaved.size() == 2);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_history_view()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    std::ofstream file(clipboard::legacy_history_path());
+    file << R"([{"text/plain": "aGVsbG8="}])";
+    file.close();
+
+    clipboard::HistoryView legacy_view;
+    assert(legacy_view.open());
+    assert(legacy_view.size() == 1);
+    assert(legacy_view.front().find("text/plain") == "hello");
+    std::filesystem::remove(clipboard::legacy_history_path());
+
+    const std::string binary_payload{"\0png\0", 5};
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(log.push_front(history, {{"text/plain", "older"}}));
+    assert(log.push_front(history, {{"text/plain", "newer"}, {"image/png", binary_payload}}));
+    assert(log.erase(history, 1));
+    assert(log.push_front(history, {{"text/plain", "newest"}}));
+
+    clipboard::HistoryView view;
+    assert(view.open());
+    assert(view.size() == history.size());
+    for (std::size_t i = 0; i < view.size(); ++i)
+    {
+        assert(view[i].to_entry() == history[i]);
+        assert(view[i].hash == clipboard::digest_entry(history[i]).hash);
+    }
+    assert(view[1].find("image/png") == binary_payload);
+    assert(!view[1].find("text/html"));
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_entry_summaries()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(log.push_front(history, {{"text/plain", "  first\nline  "}, {"text/html", "<b>first</b>"}}));
+    assert(log.push_front(history, {{"image/png", std::string("\0png", 4)}}));
+    const auto captured_at = log.digest(1).summary.captured_at;
+    assert(captured_at > 0);
+    assert(log.digest(1).summary.preview == "first line");
+    assert(log.digest(0).summary.preview.empty());
+
+    clipboard::HistoryView view;
+    assert(view.open());
+    assert(view[1].summary.preview == "first line");
+    assert(view[1].summary.captured_at == captured_at);
+    assert(clipboard::picker_label(1, view[1]) == "2: first line");
+    assert(clipboard::picker_label(0, view[0]) == "1: Non-text Clipboard Entry (image/png)");
+    assert(clipboard::picker_label(1, view[1], " | ") == "2 | first line");
+
+    assert(clipboard::picker_label_index("2: first line") == 1u);
+    assert(clipboard::picker_label_index("12 | x", " | ") == 11u);
+    assert(!clipboard::picker_label_index("2 | x"));
+    assert(!clipboard::picker_label_index("0: x"));
+    assert(!clipboard::picker_label_index(": x"));
+    assert(!clipboard::picker_label_index("first line"));
+
+    // Restoring keeps the capture time.
+    assert(log.promote(history, 1));
+    clipboard::HistoryLog reopened;
+    auto reloaded = reopened.open();
+    assert(reopened.digest(0).summary.captured_at == captured_at);
+    assert(reopened.digest(0).summary.preview == "first line");
+    assert(!reopened.digest(0).summary.partial);
+
+    // Entries whose capture was cut short stay flagged.
+    const clipboard::ClipboardEntry partial = {{"text/plain", "cut sho"}};
+    auto digest = clipboard::digest_entry(partial);
+    digest.summary.partial = true;
+    assert(reopened.push_front(reloaded, partial, std::move(digest)));
+    assert(reopened.digest(0).summary.partial);
+    clipboard::HistoryView partial_view;
+    assert(partial_view.open());
+    assert(partial_view[0].summary.partial);
+    assert(!partial_view[1].summary.partial);
+    assert(clipboard::picker_label(0, partial_view[0]) == "1: [partial] cut sho");
+    assert(clipboard::HistoryLog().open() == reloaded);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_text_search()
+{
+    const clipboard::TextQuery query("Needle");
+    const auto filter = clipboard::trigram_filter("a haystack with a NEEDLE in it");
+    assert(query.may_match(filter));
+    assert(query.matches("a haystack with a NEEDLE in it"));
+    assert(!query.matches("a haystack with a needl"));
+    assert(!query.may_match(clipboard::trigram_filter("")));
+    assert(!query.may_match(clipboard::trigram_filter("no")));
+    assert(clipboard::TextQuery("no").may_match(""));
+    assert(clipboard::trigram_filter("ab").empty());
+    // Long texts mark their trigrams in a bitmap rather than sorting them;
+    // the filter only depends on which trigrams occur.
+    std::string repeated;
+    while (repeated.size() < 64 * 1024)
+    {
+        repeated += "Needle in a haystack, ";
+    }
+    assert(clipboard::trigram_filter(repeated) ==
+           clipboard::trigram_filter("Needle in a haystack, Needle in a haystack, Needle in a haystack, "));
+    assert(clipboard::trigram_filter(std::string(8192, 'a')) == clipboard::trigram_filter("aaaa"));
+
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    // Past the 200 characters the preview keeps.
+    assert(log.push_front(history, {{"text/plain", std::string(300, '.') + "deep needle"}}));
+    assert(log.push_front(history, {{"image/png", std::string("needle")}}));
+    assert(log.push_front(history, {{"text/plain", "unrelated"}}));
+    assert(log.push_front(history, {{"text/plain", "Needlework"}, {"text/html", "<i>Needlework</i>"}}));
+    assert(!log.digest(0).summary.trigrams.empty());
+
+    clipboard::HistoryView view;
+    assert(view.open());
+    assert(view.search("NEEDLE") == std::vector<std::size_t>({0, 3}));
+    assert(view.search("deep n") == std::vector<std::size_t>({3}));
+    assert(view.search("ne") == std::vector<std::size_t>({0, 3}));
+    assert(view.search("haystack").empty());
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_fuzzy_match()
+{
+    const clipboard::FuzzyQuery query("clip");
+    assert(query.score("wl-clipboard history"));
+    assert(!query.score("pilc"));
+    // Word starts and consecutive characters beat scattered ones.
+    assert(*query.score("copy clip") > *query.score("cool lip"));
+    assert(*clipboard::FuzzyQuery("gcm").score("git commit -m") > *clipboard::FuzzyQuery("gcm").score("magic mirror"));
+    // Uppercase in the query makes it case-sensitive.
+    assert(clipboard::FuzzyQuery("todo").score("TODO: fix"));
+    assert(!clipboard::FuzzyQuery("Todo").score("TODO: fix"));
+    assert(clipboard::FuzzyQuery("").score("anything") == 0);
+
+    // Every vector width finds the same matches, including past its first
+    // block and in the scalar tail.
+    const std::string text = std::string(70, '.') + "Needle " + std::string(40, '-') + "in a haystack";
+    for (const auto level : {clipboard::SimdLevel::scalar, clipboard::SimdLevel::sse41, clipboard::SimdLevel::avx2})
+    {
+        if (level > clipboard::best_simd_level())
+        {
+            break;
+        }
+        assert(clipboard::FuzzyQuery("needle hay", level).score(text) ==
+               clipboard::FuzzyQuery("needle hay", clipboard::SimdLevel::scalar).score(text));
+        assert(!clipboard::FuzzyQuery("haystackk", level).score(text));
+    }
+
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(log.push_front(history, {{"text/plain", "git commit -m 'fix build'"}}));
+    assert(log.push_front(history, {{"image/png", std::string("\0png", 4)}}));
+    assert(log.push_front(history, {{"text/plain", "grep -r commit src"}}));
+    clipboard::HistoryView view;
+    assert(view.open());
+    const std::vector<std::size_t> all = {0, 1, 2};
+    assert(view.best_fuzzy_match(all, "gcm") == 2u);
+    assert(view.best_fuzzy_match(all, "commit") == 0u);
+    assert(view.best_fuzzy_match(all, "png") == 1u);
+    assert(view.best_fuzzy_match({0, 1}, "gcm") == 0u);
+    assert(!view.best_fuzzy_match(all, "zzz"));
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_summaryless_log_upgrade()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+
+    // A version 3 log: push records end after the payload hashes.
+    const clipboard::Payload text("older text");
+    const auto hash = text.hash();
+    std::string log_data("WLCH", 4);
+    const std::uint32_t version = 3;
+    log_data.append(reinterpret_cast<const char *>(&version), sizeof(version));
+    log_data += clipboard::encode_payload_record(hash, text);
+    std::string body;
+    const std::uint32_t count = 1;
+    const std::string mime = "text/plain";
+    const auto mime_size = static_cast<std::uint32_t>(mime.size());
+    body.append(reinterpret_cast<const char *>(&count), sizeof(count));
+    body.append(reinterpret_cast<const char *>(&mime_size), sizeof(mime_size));
+    body += mime;
+    body.append(reinterpret_cast<const char *>(&hash), sizeof(hash));
+    const auto type = static_cast<std::uint32_t>(clipboard::LogRecordType::push_entry);
+    const std::uint64_t size = body.size();
+    log_data.append(reinterpret_cast<const char *>(&type), sizeof(type));
+    log_data.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    log_data += body;
+    {
+        std::ofstream file(clipboard::history_path(), std::ios::binary);
+        file << log_data;
+    }
+
+    clipboard::HistoryView old_view;
+    assert(old_view.open());
+    assert(old_view.size() == 1);
+    assert(old_view[0].summary.preview == "older text");
+    assert(old_view.search("OLDER") == std::vector<std::size_t>({0}));
+
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(history.size() == 1);
+    assert(log.digest(0).summary.preview == "older text");
+    assert(log.digest(0).summary.captured_at == 0);
+    assert(std::filesystem::file_size(clipboard::history_path()) != log_data.size());
+
+    clipboard::HistoryView view;
+    assert(view.open());
+    assert(view[0].summary.preview == "older text");
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_blob_payloads()
+{
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+    const auto blobs = clipboard::blob_directory(clipboard::history_path());
+    clipboard::HistoryLog log;
+    auto history = log.open();
+
+    std::string large(300 * 1024, 'x');
+    large[1234] = '\0';
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    clipboard::UniqueFd read_end(pipe_fds[0]);
+    clipboard::UniqueFd write_end(pipe_fds[1]);
+    assert(clipboard::set_nonblocking(read_end.get()));
+
+    clipboard::BlobWriter writer;
+    assert(writer.open(blobs));
+    assert(writer.write(std::string_view(large).substr(0, 1000)));
+    std::size_t sent = 1000;
+    while (sent < large.size())
+    {
+        const auto n = write(write_end.get(), large.data() + sent, std::min<std::size_t>(large.size() - sent, 4096));
+        assert(n > 0);
+        sent += static_cast<std::size_t>(n);
+        while (writer.splice_from(read_end.get(), large.size()) > 0)
+        {
+        }
+    }
+    assert(writer.size() == large.size());
+    const auto payload = writer.commit();
+    assert(payload && payload->is_blob());
+    assert(payload->size() == large.size());
+    assert(payload->load() == large);
+    assert(*payload == clipboard::Payload(large));
+    assert(std::filesystem::exists(payload->blob_path()));
+
+    // Equal content commits to the same file.
+    clipboard::BlobWriter again;
+    assert(again.open(blobs) && again.write(large));
+    assert(again.commit()->blob_path() == payload->blob_path());
+
+    assert(log.push_front(history, {{"image/png", *payload}, {"text/plain", "caption"}}));
+    assert(log.push_front(history, {{"text/plain", "newer"}}));
+
+    const auto loaded = clipboard::load_history();
+    assert(loaded == history);
+    assert(loaded[1].at("image/png").is_blob());
+
+    clipboard::HistoryView view;
+    assert(view.open());
+    assert(view[1].find("image/png") == large);
+    assert(view[1].find("text/plain") == "caption");
+
+    // Files no entry refers to are removed when the log is opened.
+    std::ofstream(clipboard::blob_path(blobs, 42)) << "stale";
+    clipboard::HistoryLog reopened;
+    history = reopened.open();
+    assert(!std::filesystem::exists(clipboard::blob_path(blobs, 42)));
+    assert(std::filesystem::exists(payload->blob_path()));
+
+    // A blob outlives the erase of its last entry until the next push,
+    // which may reuse it, as the watcher does when replacing a variant.
+    assert(reopened.erase(history, 1));
+    assert(std::filesystem::exists(payload->blob_path()));
+    assert(reopened.push_front(history, {{"image/png", *payload}, {"text/plain", "other caption"}}));
+    assert(std::filesystem::exists(payload->blob_path()));
+    assert(clipboard::HistoryLog().open().front().at("image/png").load() == large);
+
+    // Once a push leaves it dead the file goes, and the same content pushed
+    // later is stored again.
+    assert(reopened.erase(history, 0));
+    assert(reopened.push_front(history, {{"text/plain", "unrelated"}}));
+    assert(!std::filesystem::exists(payload->blob_path()));
+    clipboard::BlobWriter recaptured;
+    assert(recaptured.open(blobs) && recaptured.write(large));
+    assert(reopened.push_front(history, {{"image/png", *recaptured.commit()}}));
+    assert(clipboard::HistoryLog().open().front().at("image/png").load() == large);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_content_hasher()
+{
+    std::string data;
+    for (int i = 0; i < 1000; ++i)
+    {
+        data.push_back(static_cast<char>(i * 37));
+    }
+    for (const std::size_t size : {0, 3, 31, 32, 33, 100, 1000})
+    {
+        const std::string_view whole(data.data(), size);
+        for (const std::size_t piece : {1, 7, 32, 50})
+        {
+            clipboard::ContentHasher hasher(5);
+            for (std::size_t i = 0; i < size; i += piece)
+            {
+                hasher.update(whole.substr(i, piece));
+            }
+            assert(hasher.digest() == clipboard::content_hash(whole, 5));
+        }
+    }
+}
+
+void test_blob_committer()
+{
+    const auto dir = make_temp_dir();
+    const auto blobs = dir / "blobs";
+    const std::string large(300 * 1024, 'y');
+
+    clipboard::BlobCommitter committer;
+    clipboard::BlobWriter writer;
+    assert(writer.open(blobs) && writer.write(large));
+    // What a failed commit falls back to.
+    assert(writer.read_back() == large);
+    clipboard::BlobCommitter::Result committed;
+    int calls = 0;
+    committer.commit(std::move(writer), true, [&](clipboard::BlobCommitter::Result result)
+                     { committed = std::move(result); ++calls; });
+    // A writer that was never opened fails to commit.
+    committer.commit(clipboard::BlobWriter(), true, [&](clipboard::BlobCommitter::Result result)
+                     { assert(!result.payload && !result.text_summary); ++calls; });
+
+    while (calls < 2)
+    {
+        pollfd ready{committer.get(), POLLIN, 0};
+        assert(poll(&ready, 1, 5000) == 1);
+        committer.run_callbacks();
+    }
+    const auto &payload = committed.payload;
+    assert(payload && payload->is_blob());
+    assert(*payload == clipboard::Payload(large));
+    assert(payload->load() == large);
+    // The summary the watcher would otherwise make on its loop.
+    assert(committed.text_summary);
+    const auto summary = clipboard::digest_entry({{"text/plain", *payload}}, committed.text_summary).summary;
+    assert(summary.preview == clipboard::summarize_text(large).preview);
+    assert(summary.trigrams == clipboard::trigram_filter(large));
+    assert(summary.captured_at > 0);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_compressed_payloads()
+{
+    assert(clipboard::codec_for_mime("image/png") == clipboard::Codec::none);
+    assert(clipboard::codec_for_mime("IMAGE/JPEG") == clipboard::Codec::none);
+    assert(clipboard::codec_for_mime("text/html;charset=utf-8") == clipboard::Codec::lz4);
+    assert(clipboard::codec_for_mime("UTF8_STRING") == clipboard::Codec::lz4);
+    assert(clipboard::codec_for_mime("image/bmp") == clipboard::Codec::zstd);
+
+    std::string html;
+    for (std::size_t i = 0; html.size() < 64 * 1024; ++i)
+    {
+        html += "<tr><td class=\"cell\">row " + std::to_string(i) + "</td></tr>\n";
+    }
+    std::string noise(4096, '\0');
+    std::uint64_t state = 1;
+    for (auto &c : noise)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        c = static_cast<char>(state >> 56);
+    }
+    for (const auto codec : {clipboard::Codec::lz4, clipboard::Codec::zstd})
+    {
+        const auto compressed = clipboard::compress_payload(codec, html);
+        assert(compressed && compressed->size() < html.size() / 4);
+        assert(clipboard::decompress_payload(codec, *compressed, html.size()) == html);
+        assert(!clipboard::decompress_payload(codec, *compressed, html.size() + 1));
+        assert(!clipboard::compress_payload(codec, noise));
+        assert(!clipboard::compress_payload(codec, "short"));
+    }
+
+    const auto dir = make_temp_dir();
+    use_data_home(dir);
+    const std::string bitmap(32 * 1024, 'b');
+    const std::string image(32 * 1024, 'p');
+    clipboard::HistoryLog log;
+    auto history = log.open();
+    assert(log.push_front(history, {{"UTF8_STRING", html},
+                                    {"image/bmp", bitmap},
+                                    {"image/png", image},
+                                    {"text/html", html},
+                                    {"text/plain", "caption"}}));
+    assert(history.front().at("text/html").is_compressed());
+    assert(history.front().at("text/html").codec() == clipboard::Codec::lz4);
+    assert(history.front().at("image/bmp").codec() == clipboard::Codec::zstd);
+    assert(!history.front().at("image/png").is_compressed());
+    assert(!history.front().at("text/plain").is_compressed());
+    // The shared bytes are compressed once, with the first type's codec.
+    assert(history.front().at("UTF8_STRING").compressed_data().data() ==
+           history.front().at("text/html").compressed_data().data());
+    assert(std::filesystem::file_size(clipboard::history_path()) < image.size() + html.size() / 4);
+
+    clipboard::HistoryLog reopened;
+    const auto loaded = reopened.open();
+    assert(loaded == history);
+    assert(loaded.front().at("text/html").is_compressed());
+    assert(loaded.front().at("text/html").size() == html.size());
+    assert(loaded.front().at("text/html").data() == html);
+    assert(loaded.front().at("image/bmp").load() == bitmap);
+
+    clipboard::HistoryView view;
+    assert(view.open());
+    assert(view[0].find("text/html") == html);
+    assert(view[0].find("image/bmp") == bitmap);
+    assert(view[0].find("image/png") == image);
+    assert(view[0].to_entry() == history.front());
+
+    std::filesystem::remove_all(dir);
+}
+
 void test_home_fallback()
 {
     const auto dir = make_temp_dir();
     unsetenv("XDG_DATA_HOME");
     setenv("HOME", dir.c_str(), 1);
 
-    assert(clipboard::history_path() == dir / ".local" / "share" / "clipboard_history.json");
+    assert(clipboard::history_path() == dir / ".local" / "share" / "clipboard_history.log");
+    assert(clipboard::legacy_history_path() == dir / ".local" / "share" / "clipboard_history.json");
 
     std::filesystem::remove_all(dir);
 }
@@ -107,6 +955,299 @@ void test_write_all()
     assert(std::string(buffer, static_cast<std::size_t>(n)) == payload);
 }
 
+void test_write_some()
+{
+    int fds[2] = {-1, -1};
+    assert(pipe(fds) == 0);
+    clipboard::UniqueFd read_end(fds[0]);
+    clipboard::UniqueFd write_end(fds[1]);
+    assert(clipboard::set_nonblocking(write_end.get()));
+
+    // A pipe takes the pages by reference until it is full.
+    const std::string payload(1024 * 1024, 'p');
+    bool use_vmsplice = true;
+    const auto taken = clipboard::write_some(write_end.get(), payload, use_vmsplice);
+    assert(taken > 0 && static_cast<std::size_t>(taken) < payload.size());
+    assert(use_vmsplice);
+    assert(clipboard::write_some(write_end.get(), std::string_view(payload).substr(taken), use_vmsplice) < 0);
+    assert(errno == EAGAIN);
+
+    std::string received(static_cast<std::size_t>(taken), '\0');
+    assert(read(read_end.get(), received.data(), received.size()) == taken);
+    assert(received == payload.substr(0, static_cast<std::size_t>(taken)));
+
+    // Without vmsplice the pipe holds a copy, so changing the buffer before
+    // the reader gets to it leaves the data intact.
+    std::string heap(4096, 'h');
+    use_vmsplice = false;
+    assert(clipboard::write_some(write_end.get(), heap, use_vmsplice) == 4096);
+    std::ranges::fill(heap, 'x');
+    received.assign(heap.size(), '\0');
+    assert(read(read_end.get(), received.data(), received.size()) == 4096);
+    assert(received == std::string(4096, 'h'));
+
+    // Anything else falls back to plain writes.
+    const auto dir = make_temp_dir();
+    clipboard::UniqueFd file(open((dir / "out").c_str(), O_WRONLY | O_CREAT, 0600));
+    use_vmsplice = true;
+    assert(clipboard::write_some(file.get(), "abc", use_vmsplice) == 3);
+    assert(!use_vmsplice);
+    std::filesystem::remove_all(dir);
+}
+
+void test_event_loop()
+{
+    clipboard::EventLoop loop;
+    assert(loop.initialize());
+
+    int fds[2] = {-1, -1};
+    assert(pipe(fds) == 0);
+    clipboard::UniqueFd read_end(fds[0]);
+    clipboard::UniqueFd write_end(fds[1]);
+
+    int pipe_events = 0;
+    assert(loop.add(read_end.get(), EPOLLIN, [&](std::uint32_t)
+                    {
+                        ++pipe_events;
+                        loop.remove(read_end.get()); }));
+    assert(clipboard::write_all(write_end.get(), "x"));
+    assert(loop.run_once(0));
+    assert(loop.run_once(0));
+    assert(pipe_events == 1);
+
+    clipboard::TimerFd timer;
+    assert(timer.create());
+    int timer_events = 0;
+    assert(loop.add(timer.get(), EPOLLIN, [&](std::uint32_t)
+                    { timer_events += static_cast<int>(timer.consume()); }));
+    assert(timer.arm(std::chrono::milliseconds(1)));
+    assert(loop.run_once(1000));
+    assert(timer_events == 1);
+    assert(timer.disarm());
+    assert(loop.run_once(10));
+    assert(timer_events == 1);
+}
+
+void test_serialized_mime_reads()
+{
+    const std::chrono::milliseconds idle(1000);
+    const std::chrono::milliseconds read_timeout(5000);
+    const std::chrono::steady_clock::time_point start;
+    const auto offer_deadline = start + std::chrono::milliseconds(10000);
+    const auto deadline = [&](const clipboard::MimeReadProgress &read, std::chrono::steady_clock::time_point progress)
+    { return clipboard::mime_read_deadline(read, progress, idle, read_timeout, offer_deadline); };
+
+    // A source that writes type A, then type B: both reads start together,
+    // and B's pipe stays silent for the 1.5 s that A takes.
+    clipboard::MimeReadProgress a{.started_at = start};
+    clipboard::MimeReadProgress b{.started_at = start};
+    auto progress = start;
+    for (int step = 1; step <= 15; ++step)
+    {
+        const auto now = start + std::chrono::milliseconds(100 * step);
+        assert(now < deadline(a, progress));
+        assert(now < deadline(b, progress));
+        a.last_data = progress = now;
+    }
+    for (int step = 1; step <= 15; ++step)
+    {
+        const auto now = start + std::chrono::milliseconds(1500 + 100 * step);
+        assert(now < deadline(b, progress));
+        b.last_data = progress = now;
+    }
+
+    // A read that stops partway idles out on its own clock, even while
+    // another read keeps the offer busy.
+    const clipboard::MimeReadProgress stopped{.started_at = start, .last_data = start + std::chrono::milliseconds(100)};
+    assert(deadline(stopped, start + std::chrono::milliseconds(900)) == start + std::chrono::milliseconds(1100));
+    // A silent read idles out once nothing of the offer has progressed.
+    const clipboard::MimeReadProgress silent{.started_at = start};
+    assert(deadline(silent, start) == start + idle);
+    // A steady stream is still bounded by read_timeout and the offer deadline.
+    const clipboard::MimeReadProgress streaming{.started_at = start, .last_data = start + std::chrono::milliseconds(4900)};
+    assert(deadline(streaming, start + std::chrono::milliseconds(4900)) == start + read_timeout);
+    const clipboard::MimeReadProgress late{.started_at = start + std::chrono::milliseconds(9000),
+                                           .last_data = start + std::chrono::milliseconds(9900)};
+    assert(deadline(late, start + std::chrono::milliseconds(9900)) == offer_deadline);
+}
+
+void test_payload_sender()
+{
+    clipboard::EventLoop loop;
+    assert(loop.initialize());
+    clipboard::PayloadSender sender(loop);
+
+    int fds[2] = {-1, -1};
+    assert(pipe(fds) == 0);
+    clipboard::UniqueFd read_end(fds[0]);
+    assert(clipboard::set_nonblocking(read_end.get()));
+
+    // Larger than a pipe buffer, so the transfer has to wait for the reader.
+    auto payload = std::make_shared<std::string>(512 * 1024, 's');
+    sender.send(clipboard::UniqueFd(fds[1]), *payload, payload);
+    assert(sender.size() == 1);
+
+    std::string received;
+    char buffer[65536];
+    while (!sender.empty())
+    {
+        assert(loop.run_once(1000));
+        ssize_t n = 0;
+        while ((n = read(read_end.get(), buffer, sizeof(buffer))) > 0)
+        {
+            received.append(buffer, static_cast<std::size_t>(n));
+        }
+    }
+    ssize_t n = 0;
+    while ((n = read(read_end.get(), buffer, sizeof(buffer))) > 0)
+    {
+        received.append(buffer, static_cast<std::size_t>(n));
+    }
+    assert(n == 0);
+    assert(received == *payload);
+
+    // A heap payload the pipe took whole was copied, so changing it before
+    // the reader gets to it leaves the paste intact.
+    assert(pipe(fds) == 0);
+    read_end = clipboard::UniqueFd(fds[0]);
+    auto small = std::make_shared<std::string>(4096, 'h');
+    sender.send(clipboard::UniqueFd(fds[1]), *small, small);
+    assert(sender.empty());
+    std::ranges::fill(*small, 'x');
+    small.reset();
+    received.clear();
+    while ((n = read(read_end.get(), buffer, sizeof(buffer))) > 0)
+    {
+        received.append(buffer, static_cast<std::size_t>(n));
+    }
+    assert(received == std::string(4096, 'h'));
+
+    // File-backed data is spliced from its mapping.
+    const auto dir = make_temp_dir();
+    {
+        std::ofstream(dir / "blob") << "mapped bytes";
+    }
+    auto file = std::make_shared<clipboard::MappedFile>();
+    assert(file->open(dir / "blob"));
+    assert(pipe(fds) == 0);
+    read_end = clipboard::UniqueFd(fds[0]);
+    sender.send(clipboard::UniqueFd(fds[1]), file->data(), file, true);
+    assert(sender.empty());
+    file.reset();
+    received.clear();
+    while ((n = read(read_end.get(), buffer, sizeof(buffer))) > 0)
+    {
+        received.append(buffer, static_cast<std::size_t>(n));
+    }
+    assert(received == "mapped bytes");
+    std::filesystem::remove_all(dir);
+}
+
+void test_control_socket()
+{
+    const auto dir = make_temp_dir();
+    setenv("XDG_RUNTIME_DIR", dir.c_str(), 1);
+    setenv("WAYLAND_DISPLAY", "wayland-test", 1);
+    const auto path = clipboard::control_socket_path();
+    assert(path == dir / "wl-copy-slurp-wayland-test.sock");
+
+    std::size_t index = 0;
+    std::uint64_t hash = 0;
+    assert(clipboard::decode_select_request(clipboard::encode_select_request(3, 0xabcdef), index, hash));
+    assert(index == 3 && hash == 0xabcdef);
+    assert(!clipboard::decode_select_request("select 3", index, hash));
+    assert(!clipboard::decode_select_request("select x 1", index, hash));
+    assert(!clipboard::decode_select_request("list", index, hash));
+
+    assert(!clipboard::send_control_request(path, "select 0 0", std::chrono::milliseconds(100)));
+
+    clipboard::EventLoop loop;
+    assert(loop.initialize());
+    clipboard::ControlServer server(loop);
+    std::string seen;
+    assert(server.listen(path, [&](std::string_view request)
+                         {
+                             seen = request;
+                             return std::string("ok"); }));
+    clipboard::ControlServer second(loop);
+    assert(!second.listen(path, [](std::string_view)
+                          { return std::string(); }));
+
+    clipboard::UniqueFd client(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    assert(connect(client.get(), reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0);
+    assert(clipboard::write_all(client.get(), "select 1 2a\n"));
+    while (seen.empty())
+    {
+        assert(loop.run_once(1000));
+    }
+    assert(seen == "select 1 2a");
+
+    char reply[16] = {};
+    assert(read(client.get(), reply, sizeof(reply)) == 3);
+    assert(std::string(reply) == "ok\n");
+
+    server.close();
+    assert(!std::filesystem::exists(path));
+    std::filesystem::remove_all(dir);
+}
+
+void test_base64()
+{
+    assert(clipboard::base64_encode("") == "");
+    assert(clipboard::base64_encode("f") == "Zg==");
+    assert(clipboard::base64_encode("fo") == "Zm8=");
+    assert(clipboard::base64_encode("foo") == "Zm9v");
+    assert(clipboard::base64_encode("foobar") == "Zm9vYmFy");
+
+    std::string binary;
+    std::uint32_t state = 1;
+    for (std::size_t i = 0; i < 4099; ++i)
+    {
+        state = state * 1664525 + 1013904223;
+        binary += static_cast<char>(state >> 24);
+    }
+
+    const auto best = clipboard::best_simd_level();
+    for (auto level : {clipboard::SimdLevel::scalar, clipboard::SimdLevel::sse41, clipboard::SimdLevel::avx2})
+    {
+        if (level > best)
+        {
+            break;
+        }
+        // Every length around the vector block sizes, so each path hands a
+        // different tail to the scalar code.
+        for (std::size_t size = 0; size <= 100; ++size)
+        {
+            const auto data = binary.substr(size, size);
+            const auto encoded = clipboard::base64_encode(data, level);
+            assert(encoded == clipboard::base64_encode(data, clipboard::SimdLevel::scalar));
+            assert(clipboard::base64_decode(encoded, level) == data);
+            assert(reference_base64_decode(encoded) == data);
+        }
+        const auto encoded = clipboard::base64_encode(binary, level);
+        assert(clipboard::base64_decode(encoded, level) == binary);
+        assert(reference_base64_decode(encoded) == binary);
+
+        assert(!clipboard::base64_decode("Zm9", level));
+        assert(!clipboard::base64_decode("Zm9v=A==", level));
+        assert(!clipboard::base64_decode("Zh==", level));
+        assert(!clipboard::base64_decode("Zm9=", level));
+        assert(!clipboard::base64_decode("====", level));
+        for (const char bad : {' ', '\n', '-', '_', '.', '\x80', '\0'})
+        {
+            for (const std::size_t position : {0, 17, 40, 63})
+            {
+                auto corrupted = clipboard::base64_encode(binary.substr(0, 96), level);
+                corrupted[position] = bad;
+                assert(!clipboard::base64_decode(corrupted, level));
+            }
+        }
+    }
+}
+
 void test_single_line_preview()
 {
     auto preview = clipboard::single_line_preview("  one\n\t two  ");
@@ -115,6 +1256,55 @@ void test_single_line_preview()
     preview = clipboard::single_line_preview("abcdef", 3);
     assert(preview == "abc...");
 }
+
+void test_mime_interning()
+{
+    assert(clipboard::intern_mime("text/plain") == clipboard::text_plain_mime);
+    const auto html = clipboard::intern_mime("text/html");
+    assert(clipboard::intern_mime(std::string("text/") + "html") == html);
+    assert(clipboard::mime_name(html) == "text/html");
+    assert(clipboard::find_mime("text/html") == html);
+    assert(!clipboard::find_mime("application/x-never-interned"));
+    {
+        const clipboard::MimeNames names;
+        assert(names[html] == "text/html");
+        assert(names[clipboard::text_plain_mime] == "text/plain");
+    }
+
+    // Entries keep MIME name order whatever order payloads arrive in.
+    clipboard::ClipboardEntry entry;
+    entry.insert_or_assign("text/plain", "b");
+    entry.insert_or_assign("image/png", "a");
+    entry.insert_or_assign("text/html", "c");
+    entry.insert_or_assign("text/plain", "d");
+    assert(entry.size() == 3);
+    assert(clipboard::mime_name(entry.begin()->first) == "image/png");
+    assert(clipboard::mime_name(std::prev(entry.end())->first) == "text/plain");
+    assert(entry.at(clipboard::text_plain_mime) == "d");
+    assert(entry == clipboard::ClipboardEntry({{"text/html", "c"}, {"text/plain", "d"}, {"image/png", "a"}}));
+    assert(entry.find("application/x-never-interned") == entry.end());
+}
+}
+
+void test_parse_byte_size()
+{
+    assert(clipboard::parse_byte_size("4096") == 4096);
+    assert(clipboard::parse_byte_size("64K") == 64 * 1024);
+    assert(clipboard::parse_byte_size("2m") == 2 * 1024 * 1024);
+    assert(clipboard::parse_byte_size("1G") == 1024 * 1024 * 1024);
+    assert(!clipboard::parse_byte_size(""));
+    assert(!clipboard::parse_byte_size("M"));
+    assert(!clipboard::parse_byte_size("12MB"));
+    assert(!clipboard::parse_byte_size("-1"));
+    assert(!clipboard::parse_byte_size("99999999999999999999G"));
+
+    assert(clipboard::parse_unsigned("0") == 0);
+    assert(clipboard::parse_unsigned("1500") == 1500);
+    assert(!clipboard::parse_unsigned(""));
+    assert(!clipboard::parse_unsigned("2K"));
+    assert(!clipboard::parse_unsigned("10ms"));
+    assert(!clipboard::parse_unsigned("-1"));
+    assert(!clipboard::parse_unsigned(" 1"));
 }
 
 int main()
@@ -122,8 +1312,34 @@ int main()
     test_missing_and_invalid_history();
     test_history_round_trip_and_limit();
     test_history_preserves_binary_and_whitespace();
+    test_legacy_json_import();
+    test_history_log_appends();
+    test_history_log_compaction();
+    test_background_log_writes();
+    test_signal_during_background_write();
+    test_metrics_text();
+    test_history_log_deduplicates_payloads();
+    test_loaded_payloads_stay_mapped();
+    test_history_limits();
+    test_history_view();
+    test_entry_summaries();
+    test_text_search();
+    test_fuzzy_match();
+    test_summaryless_log_upgrade();
+    test_blob_payloads();
+    test_content_hasher();
+    test_blob_committer();
+    test_compressed_payloads();
     test_home_fallback();
     test_write_all();
+    test_write_some();
+    test_event_loop();
+    test_serialized_mime_reads();
+    test_payload_sender();
+    test_control_socket();
+    test_base64();
     test_single_line_preview();
+    test_mime_interning();
+    test_parse_byte_size();
     return 0;
 }